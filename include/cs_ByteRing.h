@@ -0,0 +1,41 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Lock-free ring of bytes for a single producer and a single consumer, e.g. an interrupt
+ * and a thread. The producer only writes the head and the consumer only writes the tail, so
+ * neither has to lock out the other. When the ring is full, the newest bytes are dropped.
+ * Has no constructor and only public members, like @ref PacketQueue. Call init() before use.
+ */
+class ByteRing
+{
+      public:
+	void init(uint8_t *buf, uint32_t size);
+	uint32_t put(const uint8_t *data, uint32_t len);
+	uint32_t get(uint8_t *data, uint32_t len);
+	void clear();
+	bool isEmpty();
+	uint32_t getHead();
+	uint32_t getTail();
+
+	/** Backing memory of the ring */
+	uint8_t *_buf;
+	/** Size of the ring minus one, the size is a power of two */
+	uint32_t _mask;
+	/** Free running index where the next byte is written, only written by the producer */
+	atomic_t _head;
+	/** Free running index where the next byte is read, only written by the consumer */
+	atomic_t _tail;
+};
\ No newline at end of file
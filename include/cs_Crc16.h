@@ -0,0 +1,42 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// running CRC over data followed by its own CRC (little endian), when the data is intact
+#define CS_CRC16_CCITT_RESIDUE 0x0000
+
+// define to log a comparison with the bitwise routine of Zephyr at startup
+// #define CS_CRC16_BENCHMARK
+#define CS_CRC16_BENCHMARK_SIZE	      256
+#define CS_CRC16_BENCHMARK_ITERATIONS 1000
+
+extern const uint16_t cs_crc16_ccitt_table[256];
+
+/**
+ * @brief Update a CRC16 CCITT with one byte, the bytes can be fed one at a time while they are
+ * received. Gives the same result as crc16_ccitt of Zephyr, which uses the reflected
+ * polynomial 0x8408 without final XOR.
+ *
+ * @param crc CRC of the previous bytes, or the seed for the first byte.
+ * @param byte Byte to add.
+ *
+ * @return The updated CRC.
+ */
+static inline uint16_t cs_crc16_ccitt_update(uint16_t crc, uint8_t byte)
+{
+	return (crc >> 8) ^ cs_crc16_ccitt_table[(crc ^ byte) & 0xFF];
+}
+
+uint16_t cs_crc16_ccitt(uint16_t seed, const uint8_t *src, size_t len);
+
+#ifdef CS_CRC16_BENCHMARK
+void cs_crc16_ccitt_benchmark();
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#pragma once
+
+#include "cs_PacketBuffer.h"
+#include "cs_ReturnTypes.h"
+
+#include <zephyr/kernel.h>
+
+#include <stdint.h>
+
+// maximum size of the payload of a batch packet
+#define CS_PACKET_BATCH_MAX_SIZE   CS_PACKET_BUF_SIZE
+// maximum time a packet is held back in a batch
+#define CS_PACKET_BATCH_TIMEOUT_MS 100
+
+struct cs_packet_handler;
+
+/**
+ * @brief Collects outgoing generic packets for one destination into a single batch packet,
+ * of type @ref CS_PACKET_TYPE_BATCH. The batch is sent once it is full, when the first
+ * packet in it has waited @ref CS_PACKET_BATCH_TIMEOUT_MS, or when flushed explicitly.
+ * A batch with a single packet is sent as that packet, without copying it.
+ * Only has public members, so it can be used with CONTAINER_OF. Call init() before use.
+ */
+class PacketBatch
+{
+      public:
+	void init();
+	void add(cs_packet_handler *hdlr, cs_packet_buf *buf);
+	void flush();
+
+	/** Handler the batch is sent to */
+	cs_packet_handler *_hdlr;
+	/** First packet of the batch, kept as is until a second packet is added */
+	cs_packet_buf *_first;
+	/** Batch packet the packets are copied into, once there is more than one */
+	cs_packet_buf *_batch;
+	/** Work used to send the batch once it has been held back long enough */
+	k_work_delayable _flush_work;
+	/** Lock protecting the batch, the batch is queued after releasing it */
+	k_spinlock _lock;
+};
\ No newline at end of file
@@ -0,0 +1,129 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#pragma once
+
+#include "cs_RouterProtocol.h"
+#include "cs_ReturnTypes.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include <stdint.h>
+
+#define CS_PACKET_BUF_SIZE  250
+#define CS_PACKET_POOL_SIZE 24
+
+// header sizes of the packets that can be wrapped around a payload
+#define CS_PACKET_UART_HEADER_SIZE	5
+#define CS_PACKET_UART_CRC_SIZE		2
+#define CS_PACKET_GENERIC_HEADER_SIZE	4
+#define CS_PACKET_RESULT_HEADER_SIZE	6
+#define CS_PACKET_DATA_HEADER_SIZE	3
+// websocket frame header with a 16 bit payload length and the masking key
+#define CS_PACKET_WEBSOCKET_HEADER_SIZE 8
+
+// space reserved in front of the data, for the largest combination of headers. A packet is
+// sent over either a UART or the websocket, so only the largest transport header is counted.
+#define CS_PACKET_BUF_HEADROOM                                                                     \
+	(MAX(CS_PACKET_UART_HEADER_SIZE, CS_PACKET_WEBSOCKET_HEADER_SIZE) +                        \
+	 CS_PACKET_GENERIC_HEADER_SIZE + CS_PACKET_RESULT_HEADER_SIZE)
+// space reserved after the data, for the UART packet CRC
+#define CS_PACKET_BUF_TAILROOM CS_PACKET_UART_CRC_SIZE
+
+enum cs_packet_transport_type : uint8_t {
+	CS_DATA_INCOMING,
+	CS_DATA_OUTGOING
+};
+
+/**
+ * @brief Reference counted packet buffer, allocated from @ref PacketBufferPool.
+ * Only the pointer to the buffer is passed around through queues, so the payload is
+ * written once by the receiving transport and never copied while it is routed.
+ * Headroom is reserved in front of the data, so headers can be prepended in place.
+ *
+ * @param ref Reference counter, the buffer is returned to the pool when it drops to 0
+ * @param data Pointer to the start of the valid data in the buffer
+ * @param len Length of the valid data in bytes
+ * @param type Direction of the packet, one of @ref cs_packet_transport_type
+ * @param dest_id Instance id of the destination of the packet
+ * @param src_id Instance id of the source of the packet
+ * @param result_code Result code for the packet, used when a result packet is created
+ * @param result Set when the packet is the result of a request, described by the fields below
+ * @param command_type Command type of the request the packet belongs to
+ * @param request_id Request ID of the request the packet belongs to, 0 if unknown
+ * @param unsolicited Set when the packet is generated locally, e.g. telemetry, so it never answers
+ * a pending request
+ * @param enqueue_cyc Cycle count at which the packet was handed to the packet handler
+ * @param dispatch_cyc Cycle count at which the packet was queued for its destination
+ * @param rx_crc Running CRC16 CCITT over everything after the UART packet length field,
+ * including the CRC itself. Calculated by the transport while the bytes are received
+ * @param rx_crc_valid Set when rx_crc was calculated over the data in the buffer
+ * @param rx_cyc Cycle count at which the last byte was received, the end of the frame
+ * @param tx_done Semaphore given by the transport once the packet left the transmitter, NULL if
+ * nobody waits for it
+ * @param storage Backing storage of the buffer
+ */
+struct cs_packet_buf {
+	atomic_t ref;
+	uint8_t *data;
+	uint16_t len;
+	cs_packet_transport_type type;
+	cs_router_instance_id dest_id;
+	cs_router_instance_id src_id;
+	cs_router_result_code result_code;
+	bool result;
+	cs_router_command_type command_type;
+	uint16_t request_id;
+	bool unsolicited;
+	uint32_t enqueue_cyc;
+	uint32_t dispatch_cyc;
+	uint16_t rx_crc;
+	bool rx_crc_valid;
+	uint32_t rx_cyc;
+	k_sem *tx_done;
+	uint8_t storage[CS_PACKET_BUF_HEADROOM + CS_PACKET_BUF_SIZE + CS_PACKET_BUF_TAILROOM];
+};
+
+class PacketBufferPool
+{
+      public:
+	static PacketBufferPool *getInstance()
+	{
+		static PacketBufferPool instance;
+		return &instance;
+	}
+	// Deny implementation
+	PacketBufferPool(PacketBufferPool const &) = delete;
+	PacketBufferPool(PacketBufferPool &&) = delete;
+	void operator=(PacketBufferPool const &) = delete;
+	void operator=(PacketBufferPool &&) = delete;
+
+	cs_ret_code_t init();
+	cs_packet_buf *alloc(k_timeout_t timeout);
+
+	static cs_packet_buf *ref(cs_packet_buf *buf);
+	static void unref(cs_packet_buf *buf);
+
+	static void reset(cs_packet_buf *buf);
+	static uint8_t *add(cs_packet_buf *buf, uint16_t len);
+	static uint8_t *push(cs_packet_buf *buf, uint16_t len);
+	static uint8_t *pull(cs_packet_buf *buf, uint16_t len);
+	static uint16_t headroom(cs_packet_buf *buf);
+	static uint16_t tailroom(cs_packet_buf *buf);
+
+	/** Memory slab with fixed size blocks for the packet buffers */
+	k_mem_slab _slab;
+	/** Backing memory of the slab */
+	char __aligned(4) _slab_buf[sizeof(cs_packet_buf) * CS_PACKET_POOL_SIZE];
+
+      private:
+	PacketBufferPool() = default;
+
+	/** Initialized flag */
+	bool _initialized = false;
+};
\ No newline at end of file
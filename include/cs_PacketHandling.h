@@ -9,15 +9,31 @@
 
 #include "cs_RouterProtocol.h"
 #include "cs_ReturnTypes.h"
+#include "cs_PacketBuffer.h"
+#include "cs_PacketQueue.h"
+#include "cs_PacketBatch.h"
 
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 
 #include <stdint.h>
 #include <stdbool.h>
 
-#define CS_PACKET_BUF_SIZE   250
-#define CS_PACKET_QUEUE_SIZE 14
-#define CS_PACKET_HANDLERS   7
+// control lane carries control and result packets, data lane carries all other data
+#define CS_PACKET_CTRL_QUEUE_SIZE 6
+#define CS_PACKET_DATA_QUEUE_SIZE 14
+// amount of control packets handled in a row before one data packet is let through
+#define CS_PACKET_CTRL_BURST	  4
+
+// amount of requests that can await a result at the same time, over all destinations
+#define CS_PACKET_PENDING_REQUESTS	16
+#define CS_PACKET_REQUEST_TIMEOUT_MS	5000
+#define CS_PACKET_REQUEST_TIMEOUT_BATCH 4
+#define CS_PACKET_HANDLER_QUEUE_SIZE	8
+// destination of which outgoing data is batched
+#define CS_PACKET_BATCH_DEST_ID		CS_INSTANCE_ID_CLOUD
+// one handler slot for each instance id, so handlers can be indexed by id
+#define CS_PACKET_HANDLERS		(CS_INSTANCE_ID_BLE_CROWNSTONE_PERIPHERAL + 1)
 
 #define CS_PACKET_UART_START_TOKEN 0x7E
 #define CS_PACKET_UART_CRC_SEED	   0xFFFF
@@ -27,36 +43,71 @@
 
 typedef void (*cs_packet_transport_cb_t)(void *inst, uint8_t *msg, int msg_len);
 
-enum cs_packet_transport_type : uint8_t {
-	CS_DATA_INCOMING,
-	CS_DATA_OUTGOING
+/**
+ * @brief Request that is awaiting a result from its destination.
+ *
+ * @param in_use Set when the entry holds a pending request
+ * @param type Command type of the request
+ * @param dest_id Instance the request was sent to, which should produce the result
+ * @param src_id Instance the request came from, which the result is sent to
+ * @param id Request ID, included in the result
+ * @param seq Sequence number, used to match results to the oldest request first
+ * @param deadline Uptime in ms at which a timeout result is produced
+ */
+struct cs_packet_request {
+	bool in_use;
+	cs_router_command_type type;
+	cs_router_instance_id dest_id;
+	cs_router_instance_id src_id;
+	uint16_t id;
+	uint32_t seq;
+	int64_t deadline;
 };
 
-struct cs_packet_buffer {
-	uint8_t buf[CS_PACKET_BUF_SIZE];
-	uint16_t buf_len;
-};
+class PacketHandler;
 
-struct cs_packet_data {
-	cs_packet_transport_type type;
-	cs_router_instance_id dest_id;
-	cs_router_instance_id src_id;
-	cs_router_result_code result_code;
-	cs_packet_buffer msg;
+/**
+ * @brief Delayed work used to produce results for expired requests.
+ */
+struct cs_packet_request_timer {
+	k_work_delayable work;
+	PacketHandler *inst;
 };
 
-struct cs_packet_result {
-	cs_router_command_type type;
-	uint16_t id;
+/**
+ * @brief Runtime statistics of a handler. Updated lock-free from any context.
+ * See @ref cs_router_packet_stats_packet for the meaning of the fields.
+ */
+struct cs_packet_stats {
+	atomic_t pkts_in;
+	atomic_t bytes_in;
+	atomic_t pkts_out;
+	atomic_t bytes_out;
+	atomic_t dispatch_latency[CS_PACKET_STATS_LATENCY_BUCKETS];
+	atomic_t send_latency[CS_PACKET_STATS_LATENCY_BUCKETS];
 };
 
+/**
+ * @brief Handler transporting the packets for an instance id.
+ *
+ * @param work_item Work item running the transport function
+ * @param work_q Work queue the work item runs on
+ * @param id Instance id the handler is registered for
+ * @param target_inst Pointer to the class instance of the transport
+ * @param tx_queue Packets waiting to be transported
+ * @param stats Runtime statistics of the handler
+ * @param lock Lock protecting active, taken while the work item is scheduled
+ * @param active Set while the work item can be scheduled, cleared before the slot is cleared
+ */
 struct cs_packet_handler {
 	k_work work_item;
-	k_spinlock work_lock;
+	k_work_q *work_q;
 	cs_router_instance_id id;
 	void *target_inst;
-	cs_packet_buffer msg;
-	cs_packet_result result;
+	PacketQueue tx_queue;
+	cs_packet_stats stats;
+	k_spinlock lock;
+	bool active;
 };
 
 class PacketHandler
@@ -64,27 +115,63 @@ class PacketHandler
       public:
 	cs_ret_code_t init();
 	cs_ret_code_t registerHandler(cs_router_instance_id inst_id, void *inst,
-				      k_work_handler_t cb);
+				      k_work_handler_t cb, k_work_q *work_q = NULL);
 	cs_ret_code_t unregisterHandler(cs_router_instance_id inst_id);
 	cs_packet_handler *getHandler(cs_router_instance_id inst_id);
-	cs_ret_code_t handlePacket(cs_packet_data *data);
-
-	/** Packet message queue */
-	k_msgq _pkth_msgq;
-	/** Message queue buffer */
-	char __aligned(8) _msgq_buf[sizeof(cs_packet_data) * CS_PACKET_QUEUE_SIZE];
+	cs_packet_handler *acquireHandler(cs_router_instance_id inst_id);
+	void releaseHandler(cs_packet_handler *hdlr);
+	cs_packet_buf *allocBuffer(k_timeout_t timeout);
+	cs_ret_code_t handlePacket(cs_packet_buf *buf);
+
+	static cs_ret_code_t putPacket(cs_packet_handler *hdlr, cs_packet_buf *buf);
+	static cs_packet_buf *takePacket(cs_packet_handler *hdlr);
+	static void schedule(cs_packet_handler *hdlr);
+	static void scheduleNext(cs_packet_handler *hdlr);
+
+	cs_ret_code_t addRequest(cs_router_control_packet *ctrl_pkt, cs_router_instance_id src_id);
+	bool takeRequest(cs_router_instance_id dest_id, uint16_t request_id,
+			 cs_packet_request *req);
+	bool hasRequest(cs_router_instance_id dest_id);
+	int takeExpiredRequests(cs_packet_request *reqs, int max_reqs, int64_t *next_deadline);
+
+	cs_ret_code_t getStats(cs_router_instance_id inst_id, cs_router_packet_stats_packet *stats);
+
+	/** Control lane, for control and result packets. Rejects new packets when full */
+	PacketQueue _ctrl_queue;
+	/** Data lane, for data packets. Drops the oldest packet when full */
+	PacketQueue _data_queue;
+	/** Semaphore counting the packets added to both lanes */
+	k_sem _pkth_sem;
+
+	/** Requests awaiting a result, keyed by destination and request id */
+	cs_packet_request _requests[CS_PACKET_PENDING_REQUESTS];
+	/** Lock protecting the pending requests */
+	k_spinlock _req_lock;
+	/** Sequence number given to the next request */
+	uint32_t _req_seq = 0;
+	/** Work used to time out pending requests */
+	cs_packet_request_timer _req_timer;
+
+	/** Batch collecting the outgoing data for @ref CS_PACKET_BATCH_DEST_ID */
+	PacketBatch _batch;
 
 	/** Packet handler thread structure instance */
 	k_thread _pkth_tid;
-	/** Mutex to protect the handlers when the registers is updated */
+	/** Mutex to serialize registering and unregistering of handlers */
 	k_mutex _pkth_mtx;
 
       private:
 	/** Initialized flag */
 	bool _initialized = false;
 
-	/** Packet handler register */
+	/** Packet handler register, indexed by instance id */
 	cs_packet_handler _handlers[CS_PACKET_HANDLERS];
-	/** Amount of handlers registered */
-	int _handler_ctr = 0;
+	/** Bitmap of instance ids that have a registered handler, used for lock-free lookups */
+	ATOMIC_DEFINE(_handler_map, CS_PACKET_HANDLERS);
+	/** Bitmap of instance ids of which the handler is being unregistered, reserving the slot */
+	ATOMIC_DEFINE(_handler_closing, CS_PACKET_HANDLERS);
+	/** Amount of lookups using a handler, a slot is only cleared once this drops to zero */
+	atomic_t _handler_users[CS_PACKET_HANDLERS];
+	/** Given when the last lookup of a handler that is being unregistered released it */
+	k_sem _handler_released[CS_PACKET_HANDLERS];
 };
\ No newline at end of file
@@ -0,0 +1,72 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#pragma once
+
+#include "cs_PacketBuffer.h"
+#include "cs_ReturnTypes.h"
+
+#include <zephyr/kernel.h>
+
+#include <stdint.h>
+
+#define CS_PACKET_QUEUE_MAX_SIZE 16
+
+/**
+ * @brief Policy applied when a packet is added to a full queue.
+ */
+enum cs_packet_queue_policy : uint8_t {
+	CS_PACKET_QUEUE_DROP_NEWEST, // the packet that is added is dropped
+	CS_PACKET_QUEUE_DROP_OLDEST  // the oldest packet in the queue is dropped to make room
+};
+
+/**
+ * @brief Queue statistics.
+ *
+ * @param overflows Amount of times the queue ran full and a packet had to be dropped, a queue that
+ * stays full is counted once
+ * @param drops Amount of packets that were dropped by the queue, because it was full or purged
+ * @param high_water Highest amount of packets that were in the queue at once
+ */
+struct cs_packet_queue_stats {
+	uint32_t overflows;
+	uint32_t drops;
+	uint8_t high_water;
+};
+
+/**
+ * @brief Bounded FIFO of packet buffer pointers. Can be used from any context.
+ * Has no constructor and only public members, so it can be embedded in structures that are
+ * cleared with memset or used with CONTAINER_OF. Call init() before use.
+ */
+class PacketQueue
+{
+      public:
+	void init(uint8_t size, cs_packet_queue_policy policy);
+	cs_ret_code_t put(cs_packet_buf *buf);
+	cs_packet_buf *get();
+	uint8_t count();
+	void purge();
+	cs_packet_queue_stats getStats();
+
+	/** Ring of buffer pointers */
+	cs_packet_buf *_bufs[CS_PACKET_QUEUE_MAX_SIZE];
+	/** Maximum amount of packets in the queue */
+	uint8_t _size;
+	/** Index of the oldest packet in the ring */
+	uint8_t _head;
+	/** Amount of packets currently in the queue */
+	uint8_t _count;
+	/** Overflow policy */
+	cs_packet_queue_policy _policy;
+	/** Set when an overflow is counted, cleared once a packet is taken from the queue */
+	bool _full;
+	/** Statistics of the queue */
+	cs_packet_queue_stats _stats;
+	/** Lock protecting the ring */
+	k_spinlock _lock;
+};
\ No newline at end of file
@@ -28,9 +28,10 @@ typedef int cs_ret_code_t;
 #define CS_ERR_WIFI_DISCONNECT_REQUEST_FAILED 0x204
 #define CS_ERR_WIFI_NOT_CONNECTED	      0x205
 
-#define CS_ERR_UART_CONFIG_INVALID 0x301
-#define CS_ERR_UART_CONFIG_FAILED  0x302
-#define CS_ERR_UART_RX_FAILED	   0x303
+#define CS_ERR_UART_CONFIG_INVALID	  0x301
+#define CS_ERR_UART_CONFIG_FAILED	  0x302
+#define CS_ERR_UART_RX_FAILED		  0x303
+#define CS_ERR_UART_BAUDRATE_NOT_DETECTED 0x304
 
 #define CS_ERR_SOCKET_UNABLE_TO_RESOLVE_HOST	   0x401
 #define CS_ERR_SOCKET_CREATION_FAILED		   0x402
@@ -56,4 +57,10 @@ typedef int cs_ret_code_t;
 
 #define CS_ERR_PACKET_HANDLER_NOT_FOUND		 0x601
 #define CS_ERR_PACKET_HANDLER_ALREADY_REGISTERED 0x602
-#define CS_ERR_PACKET_HANDLER_NOT_READY		 0x603
\ No newline at end of file
+#define CS_ERR_PACKET_HANDLER_NOT_READY		 0x603
+#define CS_ERR_PACKET_BUFFER_NO_SPACE		 0x604
+#define CS_ERR_PACKET_QUEUE_FULL		 0x605
+
+#define CS_ERR_MODBUS_POLL_TABLE_FULL 0x701
+
+#define CS_ERR_P1_OBIS_TABLE_FULL 0x801
\ No newline at end of file
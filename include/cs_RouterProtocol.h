@@ -14,6 +14,9 @@
 #define CS_PROTOCOL_VERSION	 1
 #define CS_UART_PROTOCOL_VERSION 1
 
+// amount of log2 buckets in a latency histogram, the last bucket holds all larger latencies
+#define CS_PACKET_STATS_LATENCY_BUCKETS 20
+
 /**
  * @brief Frame struct for an UART Crownstone router communication packet.
  * Used for local communication.
@@ -64,7 +67,8 @@ struct cs_router_generic_packet {
 enum cs_router_generic_packet_type : uint8_t {
 	CS_PACKET_TYPE_CONTROL,
 	CS_PACKET_TYPE_RESULT,
-	CS_PACKET_TYPE_DATA
+	CS_PACKET_TYPE_DATA,
+	CS_PACKET_TYPE_BATCH // payload contains multiple generic packets, back to back
 };
 
 /**
@@ -235,9 +239,40 @@ struct cs_router_get_config_result_packet {
 enum cs_router_config_type : uint8_t {
 	CS_CONFIG_TYPE_WIFI_SSID,     // max 32 bytes
 	CS_CONFIG_TYPE_WIFI_PSK,      // max 64 bytes
-	CS_CONFIG_TYPE_UART_BAUDRATE, // uint32
+	CS_CONFIG_TYPE_UART_BAUDRATE, // uint32, setting 0 probes the baudrate
+	CS_CONFIG_TYPE_PACKET_STATS,  // read only, config id is the instance id
+	CS_CONFIG_TYPE_UART_SERIAL,   // uint32 baudrate, uint8 parity, uint8 stop bits
 };
 
+/**
+ * @brief Frame struct for the packet statistics of an instance, the payload of a get config result
+ * packet of type @ref CS_CONFIG_TYPE_PACKET_STATS. Counters are cumulative since the instance
+ * was registered. Requesting the statistics of @ref CS_INSTANCE_ID_ESP32 gives the totals over
+ * all instances, with the drops and high water mark of the packet handler lanes.
+ * Bucket i of a latency histogram counts latencies below 2^i us, but not below 2^(i-1) us.
+ *
+ * @param pkts_in Amount of packets received from the instance
+ * @param bytes_in Amount of bytes received from the instance
+ * @param pkts_out Amount of packets taken by the instance to be sent
+ * @param bytes_out Amount of bytes taken by the instance to be sent
+ * @param drops Amount of packets dropped because the queue was full
+ * @param queue_high_water Highest amount of packets that were queued at once
+ * @param dispatch_latency Histogram of the time between handing a packet to the packet handler
+ * and queueing it for the instance
+ * @param send_latency Histogram of the time between queueing a packet for the instance and the
+ * instance taking it to be sent
+ */
+struct cs_router_packet_stats_packet {
+	uint32_t pkts_in;
+	uint32_t bytes_in;
+	uint32_t pkts_out;
+	uint32_t bytes_out;
+	uint32_t drops;
+	uint8_t queue_high_water;
+	uint32_t dispatch_latency[CS_PACKET_STATS_LATENCY_BUCKETS];
+	uint32_t send_latency[CS_PACKET_STATS_LATENCY_BUCKETS];
+} __packed;
+
 /**
  * @brief Set config persistence modes.
  */
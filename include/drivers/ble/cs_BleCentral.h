@@ -25,6 +25,10 @@
 
 #define CS_BLE_CENTRAL_AVAILABLE_EVENT 1
 
+// work queue used for transmitting, ranks above the cloud link so local control stays responsive
+#define CS_BLE_CENTRAL_WORKQ_PRIORITY	K_PRIO_COOP(6)
+#define CS_BLE_CENTRAL_WORKQ_STACK_SIZE 2048
+
 enum cs_characteristics_ids {
 	SESSION_DATA_UUID = 0xE,
 	CONTROL_UUID = 0xC,
@@ -76,6 +80,8 @@ class BleCentral
 
 	/** Event to notify that the instance is ready for a new connection */
 	k_event _ble_conn_evts;
+	/** Work queue on which the packets for the BLE device are sent */
+	k_work_q _ble_workq;
 
 	/** BT connection instance reference */
 	bt_conn *_conn = NULL;
@@ -107,10 +113,12 @@ class BleCentral
 	/** BT GATT read params */
 	bt_gatt_read_params _gatt_read_params;
 
-	/** BLE buffer of 250 bytes */
-	uint8_t _ble_buf[CS_PACKET_BUF_SIZE];
-	/** Counter for the amount of bytes currently in the BLE write buffer */
-	uint16_t _ble_buf_ctr = 0;
+	/** Packet buffer that notifications and reads are currently collected in */
+	cs_packet_buf *_rx_buf = NULL;
+	/** Packet buffer that is currently being written */
+	cs_packet_buf *_tx_buf = NULL;
+	/** Handler of which the packets are written, used to continue with queued packets */
+	cs_packet_handler *_tx_hdlr = NULL;
 
 	/** Base UUID used for discovery */
 	ServiceUuid _uuid_base;
@@ -0,0 +1,135 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#pragma once
+
+#include "drivers/cs_Uart.h"
+#include "cs_ReturnTypes.h"
+#include "cs_PacketHandling.h"
+
+#include <zephyr/kernel.h>
+
+#include <stdint.h>
+
+#define CS_MODBUS_MAX_POLLS	16
+// registers per read, bounded by the payload that fits in a single data packet
+#define CS_MODBUS_MAX_REGISTERS 120
+
+// time a slave may take to start its response, on top of the time to transfer the response
+#define CS_MODBUS_TURNAROUND_MS	   100
+// amount of times a request is repeated after a timeout or corrupted response
+#define CS_MODBUS_RETRIES	   2
+// time the schedule is checked again when it is empty
+#define CS_MODBUS_IDLE_INTERVAL_MS 1000
+
+#define CS_MODBUS_CRC_POLY 0xA001
+#define CS_MODBUS_CRC_SEED 0xFFFF
+#define CS_MODBUS_CRC_SIZE 2
+
+#define CS_MODBUS_REQUEST_SIZE	     8
+// slave id, function and byte count, followed by the register values and CRC
+#define CS_MODBUS_RESPONSE_HDR_SIZE  3
+#define CS_MODBUS_EXCEPTION_SIZE     5
+#define CS_MODBUS_FUNCTION_EXCEPTION 0x80
+// slave id, function, start register, register count and status, followed by the values
+#define CS_MODBUS_RESULT_HDR_SIZE    6
+
+#define CS_MODBUS_RESPONSE_QUEUE_SIZE 2
+
+#define CS_MODBUS_THREAD_PRIORITY   K_PRIO_PREEMPT(7)
+#define CS_MODBUS_THREAD_STACK_SIZE 2048
+
+/**
+ * @brief Modbus function codes used for polling.
+ */
+enum cs_modbus_function : uint8_t {
+	CS_MODBUS_FUNCTION_READ_HOLDING_REGISTERS = 0x03,
+	CS_MODBUS_FUNCTION_READ_INPUT_REGISTERS = 0x04
+};
+
+/**
+ * @brief Status of a poll, values 0x01 - 0x7F are the exception code returned by the slave.
+ */
+enum cs_modbus_status : uint8_t {
+	CS_MODBUS_STATUS_OK = 0x00,
+	CS_MODBUS_STATUS_INVALID_RESPONSE = 0xFE, // corrupted or unexpected response on every try
+	CS_MODBUS_STATUS_TIMEOUT = 0xFF		  // no response on every try
+};
+
+/**
+ * @brief Block of registers that is read periodically.
+ *
+ * @param slave_id Address of the slave
+ * @param function Function code used to read the block
+ * @param start Address of the first register
+ * @param count Amount of registers
+ * @param interval_ms Time between two reads of the block
+ * @param next_poll Uptime in ms at which the block should be read next
+ */
+struct cs_modbus_poll {
+	uint8_t slave_id;
+	cs_modbus_function function;
+	uint16_t start;
+	uint16_t count;
+	uint32_t interval_ms;
+	int64_t next_poll;
+};
+
+/**
+ * @brief Modbus RTU master, reading register blocks according to a poll schedule.
+ * The results are sent as data packets from the UART instance to its destination.
+ *
+ * The payload of each data packet has the following layout, multi-byte fields are little endian:
+ * slave id (1), function (1), start register (2), register count (1), status (1), followed by
+ * the register values (2 each) if the status is @ref CS_MODBUS_STATUS_OK.
+ *
+ * The bus is shared with data sent to the UART by others, e.g. commands from the cloud. Received
+ * frames that don't answer a poll are routed as if the master wasn't there.
+ */
+class ModbusMaster
+{
+      public:
+	ModbusMaster() = default;
+	~ModbusMaster();
+
+	cs_ret_code_t init(Uart *uart, PacketHandler *handler);
+	cs_ret_code_t addPoll(uint8_t slave_id, cs_modbus_function function, uint16_t start,
+			      uint16_t count, uint32_t interval_ms);
+
+	static void handleResponse(cs_packet_buf *buf, void *inst);
+
+	/** Initialized flag */
+	bool _initialized = false;
+
+	/** UART the slaves are connected to, operating in idle framing */
+	Uart *_uart = NULL;
+	/** PacketHandler instance the results are sent with */
+	PacketHandler *_pkt_handler = NULL;
+	/** Handler of the UART the requests are queued on, the UART is never unregistered */
+	cs_packet_handler *_uart_hdlr = NULL;
+
+	/** Poll schedule, adjacent blocks with the same slave, function and interval are merged */
+	cs_modbus_poll _polls[CS_MODBUS_MAX_POLLS];
+	/** Amount of blocks in the poll schedule */
+	int _poll_count = 0;
+	/** Mutex protecting the poll schedule */
+	k_mutex _poll_mtx;
+	/** Semaphore waking the thread when a block is added to the schedule */
+	k_sem _poll_sem;
+
+	/** Given by the UART once the request of a poll left the transmitter */
+	k_sem _tx_done_sem;
+	/** Set while a poll waits for its response, other frames are routed right away */
+	atomic_t _rsp_pending = ATOMIC_INIT(0);
+	/** Message queue with the frames received from the UART while a response is pending */
+	k_msgq _resp_msgq;
+	/** Memory of the response message queue */
+	char __aligned(4) _resp_msgq_buf[CS_MODBUS_RESPONSE_QUEUE_SIZE * sizeof(cs_packet_buf *)];
+
+	/** Modbus thread structure instance */
+	k_thread _modbus_tid;
+};
\ No newline at end of file
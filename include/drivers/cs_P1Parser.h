@@ -0,0 +1,105 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#pragma once
+
+#include "drivers/cs_Uart.h"
+#include "cs_ReturnTypes.h"
+#include "cs_PacketHandling.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CS_P1_MAX_OBIS	16
+// lines that don't fit are skipped, only the CRC is updated with them
+#define CS_P1_LINE_SIZE 64
+
+// CRC16/ARC over the telegram, from the start token up to and including the end token
+#define CS_P1_CRC_POLY	 0xA001
+#define CS_P1_CRC_SEED	 0x0000
+#define CS_P1_CRC_DIGITS 4
+
+#define CS_P1_START_TOKEN '/'
+#define CS_P1_END_TOKEN	  '!'
+
+// values are sent as fixed point numbers with this amount of decimals
+#define CS_P1_VALUE_DECIMALS 3
+#define CS_P1_OBIS_SIZE	     5
+// OBIS code followed by the value
+#define CS_P1_ENTRY_SIZE     (CS_P1_OBIS_SIZE + 4)
+
+/**
+ * @brief Receive states of the telegram parser.
+ */
+enum cs_p1_state : uint8_t {
+	CS_P1_STATE_WAIT_START, // waiting for the start token of a telegram
+	CS_P1_STATE_DATA,	// receiving the lines of a telegram
+	CS_P1_STATE_CRC		// receiving the CRC that follows the end token
+};
+
+/**
+ * @brief OBIS reference of a value in a telegram, e.g. 1-0:1.8.1 is stored as {1, 0, 1, 8, 1}.
+ */
+struct cs_p1_obis {
+	uint8_t code[CS_P1_OBIS_SIZE];
+};
+
+/**
+ * @brief Streaming parser for DSMR P1 telegrams of smart meters. Bytes are parsed as they arrive,
+ * without buffering the telegram. The values of the configured OBIS references are sent as one
+ * data packet per telegram, from the UART instance to its destination.
+ *
+ * The payload of each data packet has the following layout, multi-byte fields are little endian:
+ * amount of values (1), followed by the OBIS reference (5) and value (4, signed) of each value.
+ * Values are fixed point numbers with @ref CS_P1_VALUE_DECIMALS decimals, e.g. 1234.567 kWh is
+ * sent as 1234567.
+ */
+class P1Parser
+{
+      public:
+	P1Parser() = default;
+	~P1Parser();
+
+	cs_ret_code_t init(Uart *uart, PacketHandler *handler);
+	cs_ret_code_t addObis(const cs_p1_obis *obis);
+
+	void parse(const uint8_t *data, uint16_t len);
+
+	static void handleData(cs_packet_buf *buf, void *inst);
+
+	/** Initialized flag */
+	bool _initialized = false;
+
+	/** UART the smart meter is connected to */
+	Uart *_uart = NULL;
+	/** PacketHandler instance the telegrams are sent with */
+	PacketHandler *_pkt_handler = NULL;
+
+	/** OBIS references of the values that are extracted */
+	cs_p1_obis _obis[CS_P1_MAX_OBIS];
+	/** Amount of configured OBIS references */
+	int _obis_count = 0;
+
+	/** Receive state of the parser */
+	cs_p1_state _state = CS_P1_STATE_WAIT_START;
+	/** Running CRC over the telegram that is being received */
+	uint16_t _crc = CS_P1_CRC_SEED;
+	/** CRC received after the end token */
+	uint16_t _rx_crc = 0;
+	/** Amount of CRC digits received */
+	uint8_t _crc_digits = 0;
+	/** Line that is being received, without line ending */
+	char _line[CS_P1_LINE_SIZE];
+	/** Length of the line that is being received */
+	uint16_t _line_len = 0;
+	/** Set when the line that is being received doesn't fit */
+	bool _line_overflow = false;
+	/** Values extracted from the telegram, indexed like the OBIS references */
+	int32_t _values[CS_P1_MAX_OBIS];
+	/** Bitmap of the values found in the telegram */
+	uint32_t _present = 0;
+};
\ No newline at end of file
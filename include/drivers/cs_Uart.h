@@ -10,11 +10,15 @@
 #include "cs_ReturnTypes.h"
 #include "cs_RouterProtocol.h"
 #include "cs_PacketHandling.h"
+#include "cs_ByteRing.h"
 
 #include <zephyr/device.h>
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/uart.h>
+#include <zephyr/drivers/gpio.h>
 #include <zephyr/sys/time_units.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/sys/atomic.h>
 
 #include <stdint.h>
 
@@ -22,13 +26,85 @@
 #define CS_UART_RS_BAUD_MIN	110
 #define CS_UART_RS_BAUD_MAX	115200
 #define CS_UART_RS_BAUD_DEFAULT 9600
+// baudrates accepted for the CM4 connection, bounded by what the ESP32 UART can generate
+#define CS_UART_CM4_BAUD_MIN	CS_UART_RS_BAUD_MIN
+#define CS_UART_CM4_BAUD_MAX	5000000
 
-#define CS_UART_BUFFER_SIZE	  256
-#define CS_UART_BUFFER_QUEUE_SIZE 2
+// defaults for the per instance devicetree properties
+// size of the RX ring in bytes, a power of two. Holds the bytes that still have to be framed
+#define CS_UART_RX_RING_SIZE	  256
+// size of the TX ring, holds multiple frames that are sent back to back
+#define CS_UART_TX_RING_SIZE	  512
+// cells of a Modbus poll in devicetree: slave, function, start, count and interval in ms
+#define CS_UART_MODBUS_POLL_CELLS 5
+
+// size of each of the two DMA receive buffers, used with the asynchronous API
+#define CS_UART_DMA_BUF_SIZE	  64
+// amount of bytes moved out of the RX fifo or ring at once
+#define CS_UART_RX_CHUNK_SIZE	  32
+// time the line should be idle before the received data is reported
+#define CS_UART_DMA_RX_TIMEOUT_US 1000
+// silence that ends a frame in idle framing, in tenths of a character time (Modbus RTU: 3.5)
+#define CS_UART_FRAME_GAP_TENTHS  35
+// amount of silences in idle and packet framing that can wait for the UART thread
+#define CS_UART_RX_FRAME_ENDS	  8
 
 #define CS_UART_THREAD_PRIORITY	  K_PRIO_COOP(7)
 #define CS_UART_THREAD_STACK_SIZE 4096
 
+// time to wait for pending data to be transmitted before the serial parameters are changed
+#define CS_UART_DRAIN_TIMEOUT_MS   500
+// baudrates tried by the probe, from high to low
+#define CS_UART_AUTOBAUD_RATES	   115200, 57600, 38400, 19200, 9600, 4800, 2400, 1200
+// time listened at each baudrate, and the bytes that should be received without errors
+#define CS_UART_AUTOBAUD_WINDOW_MS 250
+#define CS_UART_AUTOBAUD_MIN_BYTES 16
+
+// longest driver enable delay that is busy waited, longer delays are timed by the kernel and
+// rounded up to a system tick
+#define CS_UART_DE_BUSY_WAIT_MAX_US 100
+
+// work queue used for transmitting, ranks above the cloud link so local control stays responsive
+#define CS_UART_WORKQ_PRIORITY	 K_PRIO_COOP(5)
+#define CS_UART_WORKQ_STACK_SIZE 1024
+
+/**
+ * @brief Framing of the received data.
+ */
+enum cs_uart_framing_mode : uint8_t {
+	CS_UART_FRAMING_LINE,	// ASCII lines ended by CR or LF, used by RS485 and RS232
+	CS_UART_FRAMING_PACKET, // binary packets, see @ref cs_router_uart_packet
+	CS_UART_FRAMING_IDLE	// binary frames ended by silence on the line, e.g. Modbus RTU
+};
+
+/**
+ * @brief Receive states of the packet framing.
+ */
+enum cs_uart_rx_state : uint8_t {
+	CS_UART_RX_STATE_SYNC,	 // waiting for the start token
+	CS_UART_RX_STATE_LENGTH, // receiving the length field
+	CS_UART_RX_STATE_BODY	 // receiving the amount of bytes given by the length field
+};
+
+/**
+ * @brief End of a frame in idle or packet framing, marked when the line went silent.
+ *
+ * @param pos Position in the RX ring where the next frame starts, see @ref ByteRing::getHead
+ * @param cyc Cycle count at which the last byte of the frame was received
+ */
+struct cs_uart_rx_frame_end {
+	uint32_t pos;
+	uint32_t cyc;
+};
+
+/**
+ * @brief Callback that takes the received frames of a UART, instead of the packet handler.
+ *
+ * @param buf Received frame, the reference is moved to the callback
+ * @param ctx Context given when setting the callback
+ */
+typedef void (*cs_uart_rx_cb_t)(cs_packet_buf *buf, void *ctx);
+
 /**
  * @brief UART serial parameters, that both ends should agree on.
  *
@@ -42,31 +118,94 @@ struct cs_uart_config {
 	enum uart_config_stop_bits stop_bits;
 };
 
+/**
+ * @brief Static configuration of a UART instance, generated from the devicetree nodes with
+ * compatible "crownstone,router-uart". Holds the memory that is sized per instance.
+ *
+ * @param dev Pointer to UART device structure
+ * @param src_id Identifier for the UART device, used in UART packets
+ * @param dest_id Destination identifier for where the data should be transported to
+ * @param framing Framing of the received data
+ * @param half_duplex Set when the UART can't receive while transmitting
+ * @param frame_gap_tenths Silence that ends a frame in idle framing, in tenths of a character time
+ * @param baudrate Baudrate used when no serial parameters are given at initialization
+ * @param name Name of the instance, used for the work queue
+ * @param de_gpio Driver enable pin of the transceiver, asserted while transmitting. Port is NULL
+ * if there is none
+ * @param de_pre_delay_us Time between asserting driver enable and transmitting the first byte
+ * @param de_post_delay_us Time between the last byte leaving the shift register and releasing
+ * driver enable
+ * @param de_busy_wait_max_us Longest driver enable delay that is busy waited
+ * @param modbus_polls Register blocks polled by a Modbus master on the UART, each made of
+ * @ref CS_UART_MODBUS_POLL_CELLS cells
+ * @param modbus_polls_len Amount of cells in modbus_polls, 0 if the UART has no Modbus master
+ * @param rx_ring_buf Memory of the RX ring
+ * @param rx_ring_size Size of the RX ring in bytes, a power of two
+ * @param tx_ring_buf Memory of the TX ring
+ * @param tx_ring_size Size of the TX ring in bytes
+ * @param thread_stack Stack of the thread handling received frames
+ * @param thread_stack_size Size of the thread stack
+ * @param workq_stack Stack of the work queue transmitting packets
+ * @param workq_stack_size Size of the work queue stack
+ */
+struct cs_uart_instance_config {
+	const device *dev;
+	cs_router_instance_id src_id;
+	cs_router_instance_id dest_id;
+	cs_uart_framing_mode framing;
+	bool half_duplex;
+	uint16_t frame_gap_tenths;
+	uint32_t baudrate;
+	const char *name;
+	gpio_dt_spec de_gpio;
+	uint16_t de_pre_delay_us;
+	uint16_t de_post_delay_us;
+	uint16_t de_busy_wait_max_us;
+	const uint32_t *modbus_polls;
+	size_t modbus_polls_len;
+	uint8_t *rx_ring_buf;
+	uint32_t rx_ring_size;
+	uint8_t *tx_ring_buf;
+	uint32_t tx_ring_size;
+	k_thread_stack_t *thread_stack;
+	size_t thread_stack_size;
+	k_thread_stack_t *workq_stack;
+	size_t workq_stack_size;
+};
+
 class Uart
 {
       public:
-	Uart() = default;
 	/**
 	 * @brief Uart constructor for data packaging and transporting.
+	 * Instances are created from devicetree, see @ref getInstance.
 	 *
-	 * @param dev Pointer to UART device structure
-	 * @param src_id Identifier for the UART device, used in UART packets
-	 * @param dest_id Destination identifier for where the data should be transported to
-	 * @param handler PacketHandler instance
+	 * @param cfg Static configuration of the instance
 	 */
-	Uart(const device *dev, cs_router_instance_id src_id, cs_router_instance_id dest_id,
-	     PacketHandler *handler)
-		: _uart_dev(dev), _dest_id(dest_id), _src_id(src_id), _pkt_handler(handler){};
+	Uart(const cs_uart_instance_config *cfg)
+		: _cfg(cfg), _uart_dev(cfg->dev), _dest_id(cfg->dest_id), _src_id(cfg->src_id),
+		  _framing(cfg->framing), _half_duplex(cfg->half_duplex){};
 	~Uart();
 
-	cs_ret_code_t init(cs_uart_config *cfg);
+	static int getInstanceCount();
+	static Uart *getInstance(int idx);
+
+	cs_ret_code_t init(cs_uart_config *cfg, PacketHandler *handler);
 	void disable();
+	cs_ret_code_t configure(cs_uart_config *cfg);
+	cs_ret_code_t detectBaudrate(uint32_t *baudrate);
+	void setRxCallback(cs_uart_rx_cb_t cb, void *ctx);
+	void routeFrame(cs_packet_buf *buf);
+	uint32_t getCharTimeUs();
 
 	static void sendUartMessage(k_work *work);
 
 	/** Initialized flag */
 	bool _initialized = false;
 
+	/** Static configuration of the instance */
+	const cs_uart_instance_config *_cfg = NULL;
+
 	/** UART device structure, holding information about the current UART hardware */
 	const device *_uart_dev = NULL;
 
@@ -76,19 +215,86 @@ class Uart
 	cs_router_instance_id _src_id = CS_INSTANCE_ID_UNKNOWN;
 	/** PacketHanler instance to handle messages and packets */
 	PacketHandler *_pkt_handler = NULL;
-
-	/** UART message queue structure instance */
-	k_msgq _uart_msgq;
-	/** UART message buffer used by the message queue */
-	char __aligned(8) _msgq_buf[CS_UART_BUFFER_QUEUE_SIZE * CS_UART_BUFFER_SIZE];
+	/** Callback taking the received frames when a protocol runs on top of this UART */
+	cs_uart_rx_cb_t _rx_cb = NULL;
+	/** Context passed to the receive callback */
+	void *_rx_cb_ctx = NULL;
 
 	/** UART thread structure instance */
 	k_thread _uart_tid;
+	/** Work queue on which the packets for this UART are transmitted */
+	k_work_q _uart_workq;
+
+	/** Serial parameters that are currently applied */
+	uart_config _serial_cfg;
+
+	/** Ring with the received bytes, filled by the interrupt and framed by the UART thread */
+	ByteRing _rx_ring;
+	/** Semaphore signaling the UART thread that bytes were added to the RX ring */
+	k_sem _rx_sem;
+	/** Amount of received bytes dropped because the RX ring was full */
+	atomic_t _rx_dropped = ATOMIC_INIT(0);
+	/** Set when the bytes in the RX ring were received with previous serial parameters */
+	atomic_t _rx_reset = ATOMIC_INIT(0);
+	/** Set when the packet handler stopped, the UART thread then exits */
+	bool _rx_aborted = false;
+	/** Packet buffer the UART thread is currently framing into */
+	cs_packet_buf *_rx_buf = NULL;
+	/** Framing of the received data */
+	cs_uart_framing_mode _framing = CS_UART_FRAMING_LINE;
+	/** Receive state of the packet framing */
+	cs_uart_rx_state _rx_state = CS_UART_RX_STATE_SYNC;
+	/** Amount of bytes of the packet that is being received that are still expected */
+	uint16_t _rx_remaining = 0;
+	/** Running CRC over the bytes of the RX buffer that follow the UART packet length field */
+	uint16_t _rx_crc = CS_PACKET_UART_CRC_SEED;
+	/** Cycle count at which the last byte was received */
+	uint32_t _rx_last_cyc = 0;
+	/** Silence after which received data is reported, the end of a frame in idle framing */
+	uint32_t _rx_timeout_us = CS_UART_DMA_RX_TIMEOUT_US;
+	/** Timer restarted on received bytes, expires when the line went silent */
+	k_timer _rx_gap_timer;
+	/** Frame ends in idle and packet framing, marked where the bytes are received */
+	k_msgq _rx_frame_ends;
+	/** Memory of the frame ends queue */
+	cs_uart_rx_frame_end _rx_frame_ends_buf[CS_UART_RX_FRAME_ENDS];
+	/** Set while the baudrate is probed, received bytes are then only counted */
+	bool _rx_probing = false;
+	/** Amount of bytes received, used by the baudrate probe */
+	atomic_t _rx_count = ATOMIC_INIT(0);
+	/** Amount of framing and parity errors, used by the baudrate probe */
+	atomic_t _rx_errors = ATOMIC_INIT(0);
+	/** Packet buffer that is being transmitted with DMA, or waits for room in the TX ring */
+	cs_packet_buf *_tx_buf = NULL;
+	/** Ring with the bytes that are transmitted by the TX interrupt */
+	ring_buf _tx_ring;
+	/** Lock protecting the TX ring, shared with the TX interrupt */
+	k_spinlock _tx_lock;
+	/** Set when a packet is waiting for room in the TX ring */
+	bool _tx_waiting = false;
+	/** Set from the start of a transmission until the bus is released */
+	bool _tx_active = false;
+	/** Set while the driver enable is held for its post-delay, after the last byte was sent */
+	bool _tx_releasing = false;
+	/** Timer releasing the driver enable once its post-delay expired */
+	k_timer _de_timer;
+	/** Semaphore of the packet in the TX ring that is waited for, given once the bus is free */
+	k_sem *_tx_done = NULL;
+	/** Set when the UART can't receive while transmitting, RX is then disabled during TX */
+	bool _half_duplex = false;
+	/** Handler of which the packets are transmitted, used to continue pending packets */
+	cs_packet_handler *_tx_hdlr = NULL;
 
-	/** UART buffer of 256 bytes */
-	uint8_t _uart_buf[CS_UART_BUFFER_SIZE];
-	/** Counter for the amount of bytes currently in the UART buffer */
-	uint16_t _uart_buf_ctr = 0;
-	/** Pointer that points to the last handled byte in the UART buffer */
-	uint8_t *_uart_buf_ptr = NULL;
+	/** Set when the asynchronous API is used, never for half-duplex or RS485 driver UARTs */
+	bool _async = false;
+#ifdef CONFIG_UART_ASYNC_API
+	/** DMA receive buffers, one is filled by the hardware while the other is handled */
+	uint8_t _dma_rx_buf[2][CS_UART_DMA_BUF_SIZE];
+	/** Index of the DMA buffer that is provided on the next buffer request */
+	uint8_t _dma_rx_next = 0;
+	/** Set while reception is stopped on purpose, so it isn't restarted when disabled */
+	bool _rx_paused = false;
+	/** Given once reception is disabled while paused */
+	k_sem _rx_disabled_sem;
+#endif
 };
\ No newline at end of file
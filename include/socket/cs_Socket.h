@@ -33,6 +33,7 @@ class Socket
 	~Socket();
 	cs_ret_code_t init(const char *domain_name, uint16_t port);
 	cs_ret_code_t init(const char *peer_addr, cs_socket_ip ip_ver, uint16_t port);
+	cs_ret_code_t reinit();
 	cs_ret_code_t close();
 
 	/** Initialized flag */
@@ -42,6 +43,9 @@ class Socket
 	int _sock_id = -1;
 
       protected:
+	cs_ret_code_t resolveHost(const char *domain_name, uint16_t port);
+	cs_ret_code_t createSocket();
+
 	/** Structure containing address info resolved by DNS */
 	zsock_addrinfo *_res = NULL;
 	/** Generic structure with address information */
@@ -50,4 +54,10 @@ class Socket
 	int _addr_len = 0;
 	/** Host address of domain */
 	char _host[DOMAIN_NAME_MAX_LEN];
+	/** Port the connection is opened on */
+	uint16_t _port = 0;
+	/** IP version of the peer address, unused if the host is resolved by DNS */
+	cs_socket_ip _ip_ver = CS_SOCKET_IPV4;
+	/** Set if the host is a domain name that is resolved by DNS */
+	bool _use_dns = false;
 };
\ No newline at end of file
@@ -19,11 +19,59 @@
 #define CS_WEBSOCKET_THREAD_PRIORITY   K_PRIO_COOP(7)
 #define CS_WEBSOCKET_THREAD_STACK_SIZE 4096
 
-#define CS_WEBSOCKET_HTTP_HEADER_SIZE  30
-#define CS_WEBSOCKET_RECV_RETRY_TIMOUT 50
-#define CS_WEBSOCKET_URL_MAX_LEN       32
+#define CS_WEBSOCKET_HTTP_HEADER_SIZE	30
+#define CS_WEBSOCKET_URL_MAX_LEN	32
+// time given to the connection thread to exit after it is woken up to stop
+#define CS_WEBSOCKET_STOP_TIMEOUT_MS	1000
+#define CS_WEBSOCKET_CONNECT_TIMEOUT_MS 10000
 
-#define CS_WEBSOCKET_CONNECTED_EVENT 0x001
+// reconnect backoff, doubled after every failed attempt and randomized between half and full
+#define CS_WEBSOCKET_BACKOFF_MIN_MS 1000
+#define CS_WEBSOCKET_BACKOFF_MAX_MS 60000
+
+// transmit queues drained by the connection thread. Results are never dropped, as there can't be
+// more of them than pending requests. Data is dropped according to the policy when its queue is
+// full, e.g. while the link is down.
+#define CS_WEBSOCKET_TX_RESULT_QUEUE_SIZE CS_PACKET_PENDING_REQUESTS
+#define CS_WEBSOCKET_TX_DATA_QUEUE_SIZE	  12
+#define CS_WEBSOCKET_TX_DATA_POLICY	  CS_PACKET_QUEUE_DROP_OLDEST
+// time a frame may take to be sent once it is taken from its queue, the link is considered
+// stalled and reconnected after it
+#define CS_WEBSOCKET_TX_FRAME_TIMEOUT_MS  5000
+// time to wait before receiving again when no packet buffer was available
+#define CS_WEBSOCKET_RX_ALLOC_RETRY_MS	  10
+
+// messages up to this size are received, larger ones are dropped. Messages that don't fit in one
+// packet buffer are streamed in fragments, see WebSocket::setRxCallback()
+#define CS_WEBSOCKET_RX_MESSAGE_MAX_SIZE 16384
+
+// frames are sent as binary, router packets aren't valid UTF-8 text
+#define CS_WEBSOCKET_TX_OPCODE	  WEBSOCKET_OPCODE_DATA_BINARY
+#define CS_WEBSOCKET_FRAME_FIN	  0x80
+#define CS_WEBSOCKET_FRAME_MASK	  0x80
+// payload length value indicating a 16 bit extended length. Longer payloads are not supported, as
+// they don't fit in a packet buffer.
+#define CS_WEBSOCKET_FRAME_LEN_16 126
+#define CS_WEBSOCKET_MASK_SIZE	  4
+
+// measure the frames per second sent to a websocket echo server, see cs_websocket_benchmark()
+// #define CS_WEBSOCKET_BENCHMARK
+#define CS_WEBSOCKET_BENCHMARK_HOST	  "192.168.1.10"
+#define CS_WEBSOCKET_BENCHMARK_PORT	  8080
+#define CS_WEBSOCKET_BENCHMARK_SIZE	  200
+#define CS_WEBSOCKET_BENCHMARK_ITERATIONS 1000
+
+/**
+ * @brief Callback that takes the fragments of a websocket message that doesn't fit in one packet
+ * buffer. Fragments are delivered in order, each one filling a packet buffer except the last.
+ *
+ * @param buf Received fragment, the reference is moved to the callback. NULL if the message was
+ * aborted, e.g. because the connection was lost or the message exceeded its size limit
+ * @param offset Offset of the fragment in the message
+ * @param last Set if this is the last fragment of the message
+ * @param ctx Context given when setting the callback
+ */
+typedef void (*cs_websocket_rx_cb_t)(cs_packet_buf *buf, uint32_t offset, bool last, void *ctx);
 
 class WebSocket : public Socket
 {
@@ -39,7 +87,10 @@ class WebSocket : public Socket
 		: _src_id(src_id), _pkt_handler(handler){};
 
 	cs_ret_code_t connect(const char *url);
+	cs_ret_code_t open();
 	cs_ret_code_t close();
+	cs_ret_code_t wakeup();
+	void setRxCallback(cs_websocket_rx_cb_t cb, void *ctx);
 
 	static void sendMessage(k_work *work);
 
@@ -50,14 +101,46 @@ class WebSocket : public Socket
 	cs_router_instance_id _src_id = CS_INSTANCE_ID_UNKNOWN;
 	/** PacketHanler instance to handle packets */
 	PacketHandler *_pkt_handler = NULL;
+	/** Callback taking the fragments of messages that don't fit in one packet buffer */
+	cs_websocket_rx_cb_t _rx_cb = NULL;
+	/** Context passed to the receive callback */
+	void *_rx_cb_ctx = NULL;
 
-	/** Structure containing websocket receive thread information */
+	/** Structure containing websocket connection thread information */
 	k_thread _ws_tid;
-	/** Event structure used for an event when websocket is connected */
-	k_event _ws_evts;
+	/** Flag to indicate that the connection thread was started */
+	bool _ws_conn_started = false;
+	/** Eventfd polled by the connection thread next to the websocket, written to wake it up */
+	int _ws_wake_fd = -1;
+	/** Set to make the connection thread exit the next time it is woken up */
+	bool _ws_stop = false;
+	/** URL of the websocket including the forward slash, used for every (re)connection */
+	char _ws_url[CS_WEBSOCKET_URL_MAX_LEN];
+
+	/** Results waiting to be sent, sent before data */
+	PacketQueue _ws_tx_result_queue;
+	/** Data waiting to be sent, overflows according to @ref CS_WEBSOCKET_TX_DATA_POLICY */
+	PacketQueue _ws_tx_data_queue;
+	/** Packet of which the frame is being sent, with the frame header in its headroom */
+	cs_packet_buf *_ws_tx_buf = NULL;
+	/** Amount of bytes of the frame that were sent */
+	uint16_t _ws_tx_pos = 0;
+	/** Uptime in ms before which the frame should be sent completely */
+	int64_t _ws_tx_deadline = 0;
+
+	/** Buffer the message that is being received is written to, NULL if none */
+	cs_packet_buf *_ws_rx_buf = NULL;
+	/** Amount of bytes of the message that were received in the buffer */
+	uint16_t _ws_rx_len = 0;
+	/** Amount of bytes of the message that were passed on or dropped before the buffer */
+	uint32_t _ws_rx_offset = 0;
+	/** Set when the rest of the message that is being received is dropped */
+	bool _ws_rx_discard = false;
 
-	/** Receive buffer of 256 bytes for storing data received from the websocket */
-	uint8_t _ws_recv_buf[CS_PACKET_BUF_SIZE];
 	/** Temp receive buffer with extra space for HTTP headers, for the HTTP handshake */
 	uint8_t _ws_recv_tmp_buf[CS_PACKET_BUF_SIZE + CS_WEBSOCKET_HTTP_HEADER_SIZE];
-};
\ No newline at end of file
+};
+
+#ifdef CS_WEBSOCKET_BENCHMARK
+void cs_websocket_benchmark(const char *host, uint16_t port);
+#endif
\ No newline at end of file
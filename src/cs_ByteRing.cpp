@@ -0,0 +1,111 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#include "cs_ByteRing.h"
+
+#include <zephyr/sys/util.h>
+
+#include <string.h>
+
+/**
+ * @brief Initialize the ring.
+ *
+ * @param buf Backing memory of the ring.
+ * @param size Size of the memory, should be a power of two.
+ */
+void ByteRing::init(uint8_t *buf, uint32_t size)
+{
+	__ASSERT(IS_POWER_OF_TWO(size), "Ring size should be a power of two");
+
+	_buf = buf;
+	_mask = size - 1;
+	atomic_set(&_head, 0);
+	atomic_set(&_tail, 0);
+}
+
+/**
+ * @brief Add bytes to the ring, only called by the producer. Bytes that don't fit are dropped.
+ *
+ * @param data Bytes to add.
+ * @param len Amount of bytes.
+ *
+ * @return Amount of bytes that were added.
+ */
+uint32_t ByteRing::put(const uint8_t *data, uint32_t len)
+{
+	uint32_t head = atomic_get(&_head);
+	uint32_t space = _mask + 1 - (head - (uint32_t)atomic_get(&_tail));
+	len = MIN(len, space);
+
+	// copy in at most two parts, up to the end of the memory and from its start
+	uint32_t offset = head & _mask;
+	uint32_t first = MIN(len, _mask + 1 - offset);
+	memcpy(_buf + offset, data, first);
+	memcpy(_buf, data + first, len - first);
+
+	// publish the bytes only after they are written, the atomic orders the copy before it
+	atomic_set(&_head, head + len);
+
+	return len;
+}
+
+/**
+ * @brief Take bytes from the ring, only called by the consumer.
+ *
+ * @param data Buffer the bytes are copied to.
+ * @param len Size of the buffer.
+ *
+ * @return Amount of bytes that were taken.
+ */
+uint32_t ByteRing::get(uint8_t *data, uint32_t len)
+{
+	uint32_t tail = atomic_get(&_tail);
+	len = MIN(len, (uint32_t)atomic_get(&_head) - tail);
+
+	uint32_t offset = tail & _mask;
+	uint32_t first = MIN(len, _mask + 1 - offset);
+	memcpy(data, _buf + offset, first);
+	memcpy(data + first, _buf, len - first);
+
+	// release the space only after the bytes are read
+	atomic_set(&_tail, tail + len);
+
+	return len;
+}
+
+/**
+ * @brief Drop all bytes in the ring, only called by the consumer.
+ */
+void ByteRing::clear()
+{
+	atomic_set(&_tail, atomic_get(&_head));
+}
+
+/**
+ * @brief Check if the ring holds no bytes.
+ */
+bool ByteRing::isEmpty()
+{
+	return atomic_get(&_head) == atomic_get(&_tail);
+}
+
+/**
+ * @brief Get the free running index where the next byte is written. Can be used to mark a position
+ * in the stream of bytes, which is reached once the tail gets there.
+ */
+uint32_t ByteRing::getHead()
+{
+	return atomic_get(&_head);
+}
+
+/**
+ * @brief Get the free running index where the next byte is read.
+ */
+uint32_t ByteRing::getTail()
+{
+	return atomic_get(&_tail);
+}
\ No newline at end of file
@@ -0,0 +1,162 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#include "cs_PacketBatch.h"
+#include "cs_PacketHandling.h"
+#include "cs_RouterProtocol.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(cs_PacketBatch, LOG_LEVEL_INF);
+
+#include <zephyr/sys/byteorder.h>
+
+#include <string.h>
+
+/**
+ * @brief Take the current batch, to be sent to the handler once the lock is released.
+ * Should be called with the lock held.
+ *
+ * @return The packet to send, NULL if the batch was empty.
+ */
+static cs_packet_buf *flushLocked(PacketBatch *batch)
+{
+	cs_packet_buf *buf = batch->_first;
+
+	if (batch->_batch != NULL) {
+		buf = batch->_batch;
+
+		// prepend the generic packet header, see @ref cs_router_generic_packet
+		uint16_t payload_len = buf->len;
+		uint8_t *hdr = PacketBufferPool::push(buf, CS_PACKET_GENERIC_HEADER_SIZE);
+		hdr[0] = CS_PROTOCOL_VERSION;
+		hdr[1] = CS_PACKET_TYPE_BATCH;
+		sys_put_le16(payload_len, hdr + 2);
+	}
+
+	batch->_first = NULL;
+	batch->_batch = NULL;
+
+	// the timeout belongs to the batch that is taken, a new batch schedules its own
+	k_work_cancel_delayable(&batch->_flush_work);
+
+	return buf;
+}
+
+/**
+ * @brief Copy a packet to the end of the batch packet. Should be called with the lock held.
+ *
+ * @return True if the packet was copied, the reference to it is then released.
+ */
+static bool appendLocked(PacketBatch *batch, cs_packet_buf *buf)
+{
+	if (batch->_batch->len + buf->len > CS_PACKET_BATCH_MAX_SIZE) {
+		return false;
+	}
+
+	uint8_t *tail = PacketBufferPool::add(batch->_batch, buf->len);
+	if (tail == NULL) {
+		return false;
+	}
+	memcpy(tail, buf->data, buf->len);
+	// the batch is as old as its first packet
+	if (tail == batch->_batch->data) {
+		batch->_batch->enqueue_cyc = buf->enqueue_cyc;
+	}
+	PacketBufferPool::unref(buf);
+
+	return true;
+}
+
+/**
+ * @brief Send the batch once the timeout expires.
+ */
+static void handleBatchTimeout(k_work *work)
+{
+	k_work_delayable *dwork = k_work_delayable_from_work(work);
+	PacketBatch *batch = CONTAINER_OF(dwork, PacketBatch, _flush_work);
+
+	batch->flush();
+}
+
+/**
+ * @brief Initialize the batch.
+ */
+void PacketBatch::init()
+{
+	_hdlr = NULL;
+	_first = NULL;
+	_batch = NULL;
+	memset(&_lock, 0, sizeof(_lock));
+	k_work_init_delayable(&_flush_work, handleBatchTimeout);
+}
+
+/**
+ * @brief Add a generic packet to the batch.
+ *
+ * @param hdlr Handler the batch should be sent to.
+ * @param buf Packet buffer with a generic packet, the reference is moved to the batch.
+ */
+void PacketBatch::add(cs_packet_handler *hdlr, cs_packet_buf *buf)
+{
+	// at most the lone first packet and a full batch are sent
+	cs_packet_buf *out[2] = {NULL, NULL};
+
+	k_spinlock_key_t key = k_spin_lock(&_lock);
+
+	_hdlr = hdlr;
+
+	if (_first == NULL && _batch == NULL) {
+		_first = buf;
+		k_work_schedule(&_flush_work, K_MSEC(CS_PACKET_BATCH_TIMEOUT_MS));
+		k_spin_unlock(&_lock, key);
+		return;
+	}
+
+	// second packet, move the first one into a batch packet
+	if (_batch == NULL) {
+		_batch = PacketBufferPool::getInstance()->alloc(K_NO_WAIT);
+		if (_batch == NULL || !appendLocked(this, _first)) {
+			// can't batch, send the first packet on its own
+			PacketBufferPool::unref(_batch);
+			_batch = NULL;
+			out[0] = flushLocked(this);
+		} else {
+			_first = NULL;
+		}
+	}
+
+	if (_batch == NULL || !appendLocked(this, buf)) {
+		// the packet doesn't fit, send the current batch and start a new one with it
+		out[1] = flushLocked(this);
+		_first = buf;
+		k_work_schedule(&_flush_work, K_MSEC(CS_PACKET_BATCH_TIMEOUT_MS));
+	}
+
+	k_spin_unlock(&_lock, key);
+
+	// hand off outside of the lock, the handler can log when its queue is full
+	for (size_t i = 0; i < ARRAY_SIZE(out); i++) {
+		if (out[i] != NULL) {
+			PacketHandler::putPacket(hdlr, out[i]);
+		}
+	}
+}
+
+/**
+ * @brief Send the batch right away, if it holds any packets.
+ */
+void PacketBatch::flush()
+{
+	k_spinlock_key_t key = k_spin_lock(&_lock);
+	cs_packet_handler *hdlr = _hdlr;
+	cs_packet_buf *buf = flushLocked(this);
+	k_spin_unlock(&_lock, key);
+
+	if (buf != NULL) {
+		PacketHandler::putPacket(hdlr, buf);
+	}
+}
\ No newline at end of file
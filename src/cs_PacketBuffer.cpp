@@ -0,0 +1,199 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#include "cs_PacketBuffer.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(cs_PacketBuffer, LOG_LEVEL_INF);
+
+/**
+ * @brief Initialize the packet buffer pool.
+ *
+ * @return CS_OK if the pool was initialized.
+ */
+cs_ret_code_t PacketBufferPool::init()
+{
+	if (_initialized) {
+		return CS_ERR_ALREADY_INITIALIZED;
+	}
+
+	if (k_mem_slab_init(&_slab, _slab_buf, sizeof(cs_packet_buf), CS_PACKET_POOL_SIZE) != 0) {
+		LOG_ERR("%s", "Failed to initialize packet buffer slab");
+		return CS_FAIL;
+	}
+
+	_initialized = true;
+
+	return CS_OK;
+}
+
+/**
+ * @brief Allocate a packet buffer from the pool. Can be called from an ISR with K_NO_WAIT.
+ *
+ * @param timeout Time to wait for a buffer to become available.
+ *
+ * @return Pointer to a buffer with a reference count of 1 and the default headroom reserved,
+ * or NULL if none was available.
+ */
+cs_packet_buf *PacketBufferPool::alloc(k_timeout_t timeout)
+{
+	cs_packet_buf *buf;
+
+	if (!_initialized) {
+		LOG_ERR("%s", "Not initialized");
+		return NULL;
+	}
+
+	if (k_mem_slab_alloc(&_slab, (void **)&buf, timeout) != 0) {
+		LOG_WRN("%s", "Packet buffer pool exhausted");
+		return NULL;
+	}
+
+	atomic_set(&buf->ref, 1);
+	reset(buf);
+	buf->type = CS_DATA_OUTGOING;
+	buf->dest_id = CS_INSTANCE_ID_UNKNOWN;
+	buf->src_id = CS_INSTANCE_ID_UNKNOWN;
+	buf->result_code = CS_RESULT_TYPE_SUCCES;
+	buf->result = false;
+	buf->command_type = CS_COMMAND_TYPE_SET_CONFIG;
+	buf->request_id = 0;
+	buf->unsolicited = false;
+	buf->enqueue_cyc = 0;
+	buf->dispatch_cyc = 0;
+	buf->rx_crc = 0;
+	buf->rx_crc_valid = false;
+	buf->rx_cyc = 0;
+	buf->tx_done = NULL;
+
+	return buf;
+}
+
+/**
+ * @brief Take an additional reference to a buffer.
+ *
+ * @param buf Buffer to reference.
+ *
+ * @return The same buffer, for convenience.
+ */
+cs_packet_buf *PacketBufferPool::ref(cs_packet_buf *buf)
+{
+	atomic_inc(&buf->ref);
+
+	return buf;
+}
+
+/**
+ * @brief Release a reference to a buffer. The buffer is returned to the pool once the last
+ * reference is released. Safe to call from an ISR.
+ *
+ * @param buf Buffer to release, NULL is ignored.
+ */
+void PacketBufferPool::unref(cs_packet_buf *buf)
+{
+	if (buf == NULL) {
+		return;
+	}
+
+	// atomic_dec returns the previous value
+	if (atomic_dec(&buf->ref) == 1) {
+		k_mem_slab_free(&getInstance()->_slab, (void **)&buf);
+	}
+}
+
+/**
+ * @brief Discard the data in a buffer and reserve the default headroom again, so it can be
+ * reused for a new packet. The metadata is kept.
+ *
+ * @param buf Buffer to reset.
+ */
+void PacketBufferPool::reset(cs_packet_buf *buf)
+{
+	buf->data = buf->storage + CS_PACKET_BUF_HEADROOM;
+	buf->len = 0;
+}
+
+/**
+ * @brief Reserve space at the end of the data in a buffer.
+ *
+ * @param buf Buffer to add data to.
+ * @param len Amount of bytes to add.
+ *
+ * @return Pointer to the start of the added space, or NULL if there is not enough tailroom.
+ */
+uint8_t *PacketBufferPool::add(cs_packet_buf *buf, uint16_t len)
+{
+	if (len > tailroom(buf)) {
+		return NULL;
+	}
+
+	uint8_t *tail = buf->data + buf->len;
+	buf->len += len;
+
+	return tail;
+}
+
+/**
+ * @brief Prepend bytes in the headroom of a buffer, used to add a header in front of the data.
+ *
+ * @param buf Buffer to prepend data to.
+ * @param len Amount of bytes to prepend.
+ *
+ * @return Pointer to the new start of the data, or NULL if there is not enough headroom.
+ */
+uint8_t *PacketBufferPool::push(cs_packet_buf *buf, uint16_t len)
+{
+	if (len > headroom(buf)) {
+		return NULL;
+	}
+
+	buf->data -= len;
+	buf->len += len;
+
+	return buf->data;
+}
+
+/**
+ * @brief Remove bytes from the start of the data in a buffer.
+ *
+ * @param buf Buffer to remove data from.
+ * @param len Amount of bytes to remove.
+ *
+ * @return Pointer to the new start of the data, or NULL if the buffer holds less data.
+ */
+uint8_t *PacketBufferPool::pull(cs_packet_buf *buf, uint16_t len)
+{
+	if (len > buf->len) {
+		return NULL;
+	}
+
+	buf->data += len;
+	buf->len -= len;
+
+	return buf->data;
+}
+
+/**
+ * @brief Get the amount of bytes that can still be prepended to a buffer.
+ */
+uint16_t PacketBufferPool::headroom(cs_packet_buf *buf)
+{
+	return buf->data - buf->storage;
+}
+
+/**
+ * @brief Get the amount of bytes that can still be added to a buffer.
+ * The reserved tail is not included, so at most @ref CS_PACKET_BUF_SIZE bytes of data can be
+ * added behind the default headroom.
+ */
+uint16_t PacketBufferPool::tailroom(cs_packet_buf *buf)
+{
+	int end = CS_PACKET_BUF_HEADROOM + CS_PACKET_BUF_SIZE;
+	int used = headroom(buf) + buf->len;
+
+	return used < end ? end - used : 0;
+}
\ No newline at end of file
@@ -6,117 +6,155 @@
  */
 
 #include "cs_PacketHandling.h"
+#include "cs_Crc16.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(cs_PacketHandling, LOG_LEVEL_INF);
 
 #include <zephyr/sys/byteorder.h>
-#include <zephyr/sys/crc.h>
 
 K_THREAD_STACK_DEFINE(pkth_tid_stack_area, CS_PACKET_THREAD_STACK_SIZE);
 
 /**
- * @brief Wrap a payload into an UART packet.
+ * @brief Wrap the data in a packet buffer into an UART packet, in place.
+ * The header is prepended in the headroom and the CRC is appended in the reserved tail.
  *
+ * @param buf Packet buffer with the payload that should be wrapped into an UART packet
  * @param type One of @ref cs_router_uart_packet_type, type of the payload
- * @param payload Buffer that should be wrapped into an UART packet
- * @param payload_len Length of the buffer in bytes
- * @param pkt_buf Buffer where the packet should be stored
  *
- * @return Length of the UART packet in bytes.
+ * @return CS_OK if the packet was wrapped.
  */
-static int wrapUartPacket(uint8_t type, uint8_t *payload, int payload_len, uint8_t *pkt_buf)
+static cs_ret_code_t wrapUartPacket(cs_packet_buf *buf, uint8_t type)
 {
-	int uart_pkt_ctr = 0;
-	int uart_pkt_len = (sizeof(cs_router_uart_packet) - sizeof(uint8_t *)) + payload_len;
+	uint16_t payload_len = buf->len;
+	uint8_t *hdr = PacketBufferPool::push(buf, CS_PACKET_UART_HEADER_SIZE);
+	if (hdr == NULL) {
+		return CS_ERR_PACKET_BUFFER_NO_SPACE;
+	}
 
-	pkt_buf[uart_pkt_ctr++] = CS_PACKET_UART_START_TOKEN;
-	sys_put_le16(uart_pkt_len - 3, pkt_buf + uart_pkt_ctr);
-	uart_pkt_ctr += 2;
-	pkt_buf[uart_pkt_ctr++] = CS_UART_PROTOCOL_VERSION;
-	pkt_buf[uart_pkt_ctr++] = type;
-	memcpy(pkt_buf + uart_pkt_ctr, payload, payload_len);
-	uart_pkt_ctr += payload_len;
+	int hdr_ctr = 0;
+	hdr[hdr_ctr++] = CS_PACKET_UART_START_TOKEN;
+	// length of everything after the length field, including CRC
+	sys_put_le16(payload_len + 4, hdr + hdr_ctr);
+	hdr_ctr += 2;
+	hdr[hdr_ctr++] = CS_UART_PROTOCOL_VERSION;
+	hdr[hdr_ctr++] = type;
 
 	// calculate CRC16 CCITT over everything after length (so
 	// don't include start token and length)
-	uint16_t crc = crc16_ccitt(CS_PACKET_UART_CRC_SEED, pkt_buf + 3, uart_pkt_ctr - 3);
-	sys_put_le16(crc, pkt_buf + uart_pkt_ctr);
+	uint16_t crc = cs_crc16_ccitt(CS_PACKET_UART_CRC_SEED, buf->data + 3, buf->len - 3);
+	// there is always room for the CRC, as the tail of each buffer is reserved for it
+	sys_put_le16(crc, buf->data + buf->len);
+	buf->len += sizeof(crc);
 
-	return uart_pkt_len;
+	return CS_OK;
 }
 
 /**
- * @brief Wrap a payload into a generic packet.
+ * @brief Wrap the data in a packet buffer into a generic packet, in place.
  *
+ * @param buf Packet buffer with the payload that should be wrapped into a generic packet
  * @param type One of @ref cs_router_generic_packet_type, type of the payload
- * @param payload Buffer that should be wrapped into a generic packet
- * @param payload_len Length of the buffer in bytes
- * @param pkt_buf Buffer where the packet should be stored
  *
- * @return Length of the generic packet in bytes.
+ * @return CS_OK if the packet was wrapped.
  */
-static int wrapGenericPacket(uint8_t type, uint8_t *payload, int payload_len, uint8_t *pkt_buf)
+static cs_ret_code_t wrapGenericPacket(cs_packet_buf *buf, uint8_t type)
 {
-	pkt_buf[0] = CS_PROTOCOL_VERSION;
-	pkt_buf[1] = type;
-	sys_put_le16(payload_len, pkt_buf + 2);
-	memcpy(pkt_buf + 4, payload, payload_len);
+	uint16_t payload_len = buf->len;
+	uint8_t *hdr = PacketBufferPool::push(buf, CS_PACKET_GENERIC_HEADER_SIZE);
+	if (hdr == NULL) {
+		return CS_ERR_PACKET_BUFFER_NO_SPACE;
+	}
 
-	return (sizeof(cs_router_generic_packet) - sizeof(uint8_t *)) + payload_len;
+	hdr[0] = CS_PROTOCOL_VERSION;
+	hdr[1] = type;
+	sys_put_le16(payload_len, hdr + 2);
+
+	return CS_OK;
 }
 
 /**
- * @brief Wrap a payload into a data packet.
+ * @brief Wrap the data in a packet buffer into a data packet, in place.
  *
+ * @param buf Packet buffer with the payload that should be wrapped into a data packet
  * @param src_id One of @ref cs_router_instance_id, identifier of the payload source
- * @param payload Buffer that should be wrapped into a data packet
- * @param payload_len Length of the buffer in bytes
- * @param pkt_buf Buffer where the packet should be stored
  *
- * @return Length of the data packet in bytes.
+ * @return CS_OK if the packet was wrapped.
  */
-static int wrapDataPacket(uint8_t src_id, uint8_t *payload, int payload_len, uint8_t *pkt_buf)
+static cs_ret_code_t wrapDataPacket(cs_packet_buf *buf, uint8_t src_id)
 {
-	pkt_buf[0] = src_id;
-	sys_put_le16(payload_len, pkt_buf + 1);
-	memcpy(pkt_buf + 3, payload, payload_len);
+	uint16_t payload_len = buf->len;
+	uint8_t *hdr = PacketBufferPool::push(buf, CS_PACKET_DATA_HEADER_SIZE);
+	if (hdr == NULL) {
+		return CS_ERR_PACKET_BUFFER_NO_SPACE;
+	}
+
+	hdr[0] = src_id;
+	sys_put_le16(payload_len, hdr + 1);
 
-	return (sizeof(cs_router_data_packet) - sizeof(uint8_t *)) + payload_len;
+	return CS_OK;
 }
 
 /**
- * @brief Wrap a payload into a result packet.
+ * @brief Wrap the data in a packet buffer into a result packet, in place.
+ *
+ * @param buf Packet buffer with the payload that should be wrapped into a result packet
+ * @param command_type One of @ref cs_router_command_type, the command this is the result of
+ * @param result_code One of @ref cs_router_result_code
+ * @param request_id Request ID of the command
+ *
+ * @return CS_OK if the packet was wrapped.
  */
-static int wrapResultPacket(uint8_t command_type, uint8_t result_code, uint16_t request_id,
-			    uint8_t *payload, uint16_t payload_len, uint8_t *pkt_buf)
+static cs_ret_code_t wrapResultPacket(cs_packet_buf *buf, uint8_t command_type,
+				      uint8_t result_code, uint16_t request_id)
 {
-	int result_pkt_ctr = 0;
+	uint16_t payload_len = buf->len;
+	uint8_t *hdr = PacketBufferPool::push(buf, CS_PACKET_RESULT_HEADER_SIZE);
+	if (hdr == NULL) {
+		return CS_ERR_PACKET_BUFFER_NO_SPACE;
+	}
 
-	pkt_buf[result_pkt_ctr++] = command_type;
-	pkt_buf[result_pkt_ctr++] = result_code;
-	sys_put_le16(request_id, pkt_buf + result_pkt_ctr);
-	result_pkt_ctr += 2;
-	sys_put_le16(payload_len, pkt_buf + result_pkt_ctr);
-	result_pkt_ctr += 2;
-	memcpy(pkt_buf + result_pkt_ctr, payload, payload_len);
+	int hdr_ctr = 0;
+	hdr[hdr_ctr++] = command_type;
+	hdr[hdr_ctr++] = result_code;
+	sys_put_le16(request_id, hdr + hdr_ctr);
+	hdr_ctr += 2;
+	sys_put_le16(payload_len, hdr + hdr_ctr);
 
-	return (sizeof(cs_router_result_packet) - sizeof(uint8_t *)) + payload_len;
+	return CS_OK;
 }
 
 /**
- * @brief Load a UART packet from a buffer.
+ * @brief Load a UART packet from a packet buffer.
+ * The CRC that was calculated while receiving is used when it covers exactly this packet.
  *
  * @param pkt Pointer to instance of @ref cs_router_uart_packet, which should be loaded with data
- * @param buffer Buffer with data that should be created into an UART packet
+ * @param buf Packet buffer with data that should be created into an UART packet
+ *
+ * @return True if the length field matches the received data and the CRC is valid.
  */
-static void loadUartPacket(cs_router_uart_packet *uart_pkt, uint8_t *buffer)
+static bool loadUartPacket(cs_router_uart_packet *uart_pkt, cs_packet_buf *buf)
 {
+	uint8_t *buffer = buf->data;
 	int pkt_ctr = 0;
 
+	// start token and length, followed by at least protocol version, type and CRC
+	if (buf->len < 7) {
+		LOG_WRN("%s", "Received UART packet is too short");
+		return false;
+	}
+
 	uart_pkt->start_token = buffer[pkt_ctr++];
 	uart_pkt->length = sys_get_le16(buffer + pkt_ctr);
 	pkt_ctr += 2;
+
+	// the length field is not trusted before it matches the received data
+	if (uart_pkt->length < 4 || uart_pkt->length + 3 != buf->len) {
+		LOG_WRN("UART packet length %u doesn't match the received %u bytes",
+			uart_pkt->length, buf->len);
+		return false;
+	}
+
 	uart_pkt->protocol_version = buffer[pkt_ctr++];
 	uart_pkt->type = buffer[pkt_ctr++];
 
@@ -124,14 +162,29 @@ static void loadUartPacket(cs_router_uart_packet *uart_pkt, uint8_t *buffer)
 	uart_pkt->payload = &buffer[pkt_ctr];
 	pkt_ctr += payload_len;
 
-	// check CRC CCITT over everything after length, not including CRC (uint16) itself
-	uint16_t check_crc = crc16_ccitt(CS_PACKET_UART_CRC_SEED, buffer + 3, uart_pkt->length - 2);
 	uint16_t received_crc = sys_get_le16(buffer + pkt_ctr);
+
+	// the running CRC includes the received CRC, so it ends at the residue for a valid packet
+	if (buf->rx_crc_valid) {
+		if (buf->rx_crc != CS_CRC16_CCITT_RESIDUE) {
+			LOG_WRN("CRC mismatch on received UART packet. Received: %hu",
+				received_crc);
+			return false;
+		}
+		return true;
+	}
+
+	// check CRC CCITT over everything after length, not including CRC (uint16) itself
+	uint16_t check_crc =
+		cs_crc16_ccitt(CS_PACKET_UART_CRC_SEED, buffer + 3, uart_pkt->length - 2);
 	// CRC doesn't match, invalid packet
 	if (check_crc != received_crc) {
 		LOG_WRN("CRC mismatch on received UART packet. Calculated: %hu, Received: %hu",
 			check_crc, received_crc);
+		return false;
 	}
+
+	return true;
 }
 
 /**
@@ -178,89 +231,270 @@ static void loadControlPacket(cs_router_control_packet *ctrl_pkt, uint8_t *buffe
 	ctrl_pkt->payload = &buffer[pkt_ctr];
 }
 
+/**
+ * @brief Add a latency sample to a log2 histogram.
+ *
+ * @param hist Histogram with @ref CS_PACKET_STATS_LATENCY_BUCKETS buckets.
+ * @param start_cyc Cycle count at the start of the measured interval.
+ */
+static void recordLatency(atomic_t *hist, uint32_t start_cyc)
+{
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start_cyc);
+	int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+
+	atomic_inc(&hist[MIN(bucket, CS_PACKET_STATS_LATENCY_BUCKETS - 1)]);
+}
+
+/**
+ * @brief Write packet statistics to a buffer, as described by @ref cs_router_packet_stats_packet.
+ *
+ * @return Pointer to the end of the written data.
+ */
+static uint8_t *writeStats(cs_router_packet_stats_packet *stats, uint8_t *buffer)
+{
+	sys_put_le32(stats->pkts_in, buffer);
+	sys_put_le32(stats->bytes_in, buffer + 4);
+	sys_put_le32(stats->pkts_out, buffer + 8);
+	sys_put_le32(stats->bytes_out, buffer + 12);
+	sys_put_le32(stats->drops, buffer + 16);
+	buffer[20] = stats->queue_high_water;
+	buffer += 21;
+
+	for (int i = 0; i < CS_PACKET_STATS_LATENCY_BUCKETS; i++, buffer += 4) {
+		sys_put_le32(stats->dispatch_latency[i], buffer);
+	}
+	for (int i = 0; i < CS_PACKET_STATS_LATENCY_BUCKETS; i++, buffer += 4) {
+		sys_put_le32(stats->send_latency[i], buffer);
+	}
+
+	return buffer;
+}
+
+/**
+ * @brief Handle a control packet of which this controller is the destination. The buffer is
+ * reused for the result, which is handed back to the packet handler.
+ */
+static void handleLocalCommand(cs_packet_buf *buf, PacketHandler *ph_inst)
+{
+	cs_router_result_code result_code = CS_RESUKT_TYPE_NOT_IMPLEMENTED;
+	cs_router_get_config_packet get_cfg_pkt;
+	cs_router_packet_stats_packet stats;
+
+	// 0 means no result is expected
+	if (buf->request_id == 0) {
+		PacketBufferPool::unref(buf);
+		return;
+	}
+
+	switch (buf->command_type) {
+	case CS_COMMAND_TYPE_GET_CONFIG: {
+		if (buf->len < sizeof(cs_router_get_config_packet)) {
+			result_code = CS_RESULT_TYPE_WRONG_PAYLOAD_LENGTH;
+			break;
+		}
+		memcpy(&get_cfg_pkt, buf->data, sizeof(get_cfg_pkt));
+
+		if (get_cfg_pkt.config_type != CS_CONFIG_TYPE_PACKET_STATS) {
+			result_code = CS_RESULT_TYPE_UNKNOWN_TYPE;
+			break;
+		}
+		cs_router_instance_id inst_id = (cs_router_instance_id)get_cfg_pkt.config_id;
+		if (ph_inst->getStats(inst_id, &stats) == CS_OK) {
+			result_code = CS_RESULT_TYPE_SUCCES;
+		} else {
+			result_code = CS_RESULT_TYPE_MISMATCH;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	PacketBufferPool::reset(buf);
+
+	// only a get config of the packet statistics has a payload
+	if (result_code == CS_RESULT_TYPE_SUCCES) {
+		// header and reserved byte of the get config result around the statistics
+		uint8_t *payload = PacketBufferPool::add(buf, sizeof(stats) + 4);
+		payload[0] = get_cfg_pkt.config_type;
+		payload[1] = get_cfg_pkt.config_id;
+		payload[2] = get_cfg_pkt.persistence_mode;
+		uint8_t *end = writeStats(&stats, payload + 3);
+		end[0] = 0;
+	}
+
+	// send the result back to where the command came from
+	buf->type = CS_DATA_OUTGOING;
+	buf->dest_id = buf->src_id;
+	buf->src_id = CS_INSTANCE_ID_ESP32;
+	buf->result = true;
+	buf->result_code = result_code;
+
+	ph_inst->handlePacket(buf);
+}
+
 /**
  * @brief Handler for an incoming packet, from either CM4 or cloud.
+ * The buffer is handed over to the destination, with its data pointing to the control payload.
  */
-static void handleIncomingPacket(cs_packet_data *data, void *pkth)
+static void handleIncomingPacket(cs_packet_buf *buf, void *pkth)
 {
 	PacketHandler *ph_inst = static_cast<PacketHandler *>(pkth);
 	cs_router_generic_packet generic_pkt;
 
-	if (data->src_id == CS_INSTANCE_ID_UART_CM4) {
+	if (buf->src_id == CS_INSTANCE_ID_UART_CM4) {
 		cs_router_uart_packet uart_pkt;
-		loadUartPacket(&uart_pkt, data->msg.buf);
+		if (!loadUartPacket(&uart_pkt, buf)) {
+			PacketBufferPool::unref(buf);
+			return;
+		}
 		loadGenericPacket(&generic_pkt, uart_pkt.payload);
 	} else {
-		loadGenericPacket(&generic_pkt, data->msg.buf);
+		loadGenericPacket(&generic_pkt, buf->data);
+	}
+
+	if (generic_pkt.type != CS_PACKET_TYPE_CONTROL) {
+		PacketBufferPool::unref(buf);
+		return;
+	}
+
+	cs_router_control_packet ctrl_pkt;
+	loadControlPacket(&ctrl_pkt, generic_pkt.payload);
+
+	// strip all headers, so only the control payload remains
+	uint16_t hdr_len = ctrl_pkt.payload - buf->data;
+	if (PacketBufferPool::pull(buf, hdr_len) == NULL || ctrl_pkt.length > buf->len) {
+		LOG_WRN("%s", "Control packet length exceeds received data, dropping");
+		PacketBufferPool::unref(buf);
+		return;
 	}
+	buf->len = ctrl_pkt.length;
 
-	if (generic_pkt.type == CS_PACKET_TYPE_CONTROL) {
-		cs_router_control_packet ctrl_pkt;
-		loadControlPacket(&ctrl_pkt, generic_pkt.payload);
+	// let the destination know which request it is handling
+	buf->command_type = (cs_router_command_type)ctrl_pkt.command_type;
+	buf->request_id = ctrl_pkt.request_id;
 
-		cs_packet_data out;
-		memset(&out, 0, sizeof(out));
-		cs_packet_handler *outh =
-			ph_inst->getHandler((cs_router_instance_id)ctrl_pkt.dest_id);
-		// > 0 means we need to reply with a result
-		outh->result.id = ctrl_pkt.request_id;
-		outh->result.type = (cs_router_command_type)ctrl_pkt.command_type;
-		outh->msg.buf_len = ctrl_pkt.length;
-		memcpy(outh->msg.buf, ctrl_pkt.payload, ctrl_pkt.length);
-		// dispatch data to peripheral
-		k_work_submit(&outh->work_item);
+	if (ctrl_pkt.dest_id == CS_INSTANCE_ID_ESP32) {
+		handleLocalCommand(buf, ph_inst);
+		return;
 	}
+
+	cs_packet_handler *outh = ph_inst->acquireHandler((cs_router_instance_id)ctrl_pkt.dest_id);
+	if (outh == NULL) {
+		LOG_WRN("No handler registered for destination %d", ctrl_pkt.dest_id);
+		PacketBufferPool::unref(buf);
+		return;
+	}
+	// > 0 means we need to reply with a result
+	if (ctrl_pkt.request_id > 0) {
+		ph_inst->addRequest(&ctrl_pkt, buf->src_id);
+	}
+	// dispatch data to peripheral
+	PacketHandler::putPacket(outh, buf);
+	ph_inst->releaseHandler(outh);
 }
 
 /**
  * @brief Handler for data coming from peripherals.
+ * All headers are prepended in the headroom of the buffer, so the payload is never moved.
  */
-static void handleOutgoingPacket(cs_packet_data *data, void *pkth)
+static void handleOutgoingPacket(cs_packet_buf *buf, void *pkth)
 {
 	PacketHandler *ph_inst = static_cast<PacketHandler *>(pkth);
-	uint8_t pkt_buf[CS_PACKET_BUF_SIZE];
-	int pkt_len;
 	cs_router_generic_packet_type pkt_type;
+	cs_ret_code_t ret;
 
-	// if a result id was set by the incoming packet handler,
-	// create a result packet for request
-	cs_packet_result *result = &ph_inst->getHandler(data->src_id)->result;
-	if (result->id > 0) {
-		pkt_len = wrapResultPacket(result->type, data->result_code, result->id,
-					   data->msg.buf, data->msg.buf_len, pkt_buf);
+	// match the packet with a pending request for its source, in which case a result packet is
+	// created and sent to where the request came from. Timeout results are already matched.
+	cs_packet_request req;
+	bool matchable = !buf->result && !buf->unsolicited;
+	if (matchable && ph_inst->takeRequest(buf->src_id, buf->request_id, &req)) {
+		buf->result = true;
+		buf->command_type = req.type;
+		buf->request_id = req.id;
+		if (ph_inst->getHandler(req.src_id) != NULL) {
+			buf->dest_id = req.src_id;
+		}
+	}
+
+	cs_packet_handler *outh = ph_inst->acquireHandler(buf->dest_id);
+	if (outh == NULL) {
+		LOG_WRN("No handler registered for route %d -> %d", buf->src_id, buf->dest_id);
+		PacketBufferPool::unref(buf);
+		return;
+	}
+
+	if (buf->result) {
+		ret = wrapResultPacket(buf, buf->command_type, buf->result_code, buf->request_id);
 		pkt_type = CS_PACKET_TYPE_RESULT;
-		// request handled, reset the result id
-		result->id = 0;
 	} else {
 		// all other data is wrapped as "data", the contents are unknown
-		pkt_len = wrapDataPacket(data->src_id, data->msg.buf, data->msg.buf_len, pkt_buf);
+		ret = wrapDataPacket(buf, buf->src_id);
 		pkt_type = CS_PACKET_TYPE_DATA;
 	}
 
-	uint8_t tmp_buf[pkt_len];
-	memcpy(tmp_buf, pkt_buf, pkt_len);
-
-	int generic_pkt_len = wrapGenericPacket(pkt_type, tmp_buf, pkt_len, pkt_buf);
-	pkt_len = generic_pkt_len;
+	ret |= wrapGenericPacket(buf, pkt_type);
 
 	// when packet should be routed to CM4
-	if (data->dest_id == CS_INSTANCE_ID_UART_CM4) {
-		uint8_t generic_pkt_tmp_buf[generic_pkt_len];
-		memcpy(generic_pkt_tmp_buf, pkt_buf, generic_pkt_len);
+	if (buf->dest_id == CS_INSTANCE_ID_UART_CM4) {
+		ret |= wrapUartPacket(buf, CS_PACKET_TYPE_GENERIC);
+	}
 
-		pkt_len = wrapUartPacket(CS_PACKET_TYPE_GENERIC, generic_pkt_tmp_buf,
-					 generic_pkt_len, pkt_buf);
+	if (ret != CS_OK) {
+		LOG_WRN("%s", "Not enough headroom to wrap packet, dropping");
+		PacketBufferPool::unref(buf);
+		ph_inst->releaseHandler(outh);
+		return;
+	}
+
+	if (buf->dest_id == CS_PACKET_BATCH_DEST_ID) {
+		if (!buf->result) {
+			ph_inst->_batch.add(outh, buf);
+			ph_inst->releaseHandler(outh);
+			return;
+		}
+		// results are never held back, send the pending data first to keep the order
+		ph_inst->_batch.flush();
 	}
 
-	cs_packet_handler *outh = ph_inst->getHandler(data->dest_id);
-	outh->msg.buf_len = pkt_len;
-	memcpy(outh->msg.buf, pkt_buf, pkt_len);
 	// dispatch packet to the target
-	k_work_submit(&outh->work_item);
+	PacketHandler::putPacket(outh, buf);
+	ph_inst->releaseHandler(outh);
 }
 
 /**
- * @brief Thread function that handles packet buffers from the message queue.
+ * @brief Take the next packet from the lanes. Control packets have priority, but after
+ * @ref CS_PACKET_CTRL_BURST control packets in a row one data packet is let through, so
+ * data can't be starved completely.
+ *
+ * @param pkth_inst Pointer to the class instance.
+ * @param ctrl_served Amount of control packets handled in a row, updated by this function.
+ *
+ * @return The packet buffer, or NULL if both lanes are empty.
+ */
+static cs_packet_buf *getNextPacket(PacketHandler *pkth_inst, int *ctrl_served)
+{
+	cs_packet_buf *buf = NULL;
+
+	if (*ctrl_served < CS_PACKET_CTRL_BURST) {
+		buf = pkth_inst->_ctrl_queue.get();
+	}
+	if (buf != NULL) {
+		(*ctrl_served)++;
+		return buf;
+	}
+
+	*ctrl_served = 0;
+	buf = pkth_inst->_data_queue.get();
+	if (buf == NULL) {
+		buf = pkth_inst->_ctrl_queue.get();
+	}
+
+	return buf;
+}
+
+/**
+ * @brief Thread function that handles packet buffers from the lanes.
  *
  * @param inst Pointer to the class instance.
  * @param unused1 Unused parameter, is NULL.
@@ -269,22 +503,71 @@ static void handleOutgoingPacket(cs_packet_data *data, void *pkth)
 static void handlePacketBuffers(void *inst, void *unused1, void *unused2)
 {
 	PacketHandler *pkth_inst = static_cast<PacketHandler *>(inst);
-	cs_packet_data pkt_data;
+	int ctrl_served = 0;
 
 	while (1) {
-		// wait till message is retrieved from message queue
-		if (k_msgq_get(&pkth_inst->_pkth_msgq, &pkt_data, K_FOREVER) == 0) {
-			switch (pkt_data.type) {
-			case CS_DATA_INCOMING:
-				handleIncomingPacket(&pkt_data, pkth_inst);
-				break;
-			case CS_DATA_OUTGOING:
-				handleOutgoingPacket(&pkt_data, pkth_inst);
-				break;
+		// wait till a packet is added to one of the lanes
+		k_sem_take(&pkth_inst->_pkth_sem, K_FOREVER);
+
+		// the semaphore can be given more often than there are packets,
+		// when the data lane dropped its oldest packet
+		cs_packet_buf *buf = getNextPacket(pkth_inst, &ctrl_served);
+		if (buf == NULL) {
+			continue;
+		}
+
+		switch (buf->type) {
+		case CS_DATA_INCOMING:
+			handleIncomingPacket(buf, pkth_inst);
+			break;
+		case CS_DATA_OUTGOING:
+			handleOutgoingPacket(buf, pkth_inst);
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Produce timeout results for requests that did not receive a result in time.
+ * The results are handled as outgoing packets from the destination of the request.
+ */
+static void handleRequestTimeouts(k_work *work)
+{
+	k_work_delayable *dwork = k_work_delayable_from_work(work);
+	cs_packet_request_timer *timer = CONTAINER_OF(dwork, cs_packet_request_timer, work);
+	PacketHandler *pkth_inst = timer->inst;
+
+	// handle in small batches to limit stack usage on the system work queue
+	cs_packet_request expired[CS_PACKET_REQUEST_TIMEOUT_BATCH];
+	int64_t next_deadline;
+	int n_expired;
+
+	do {
+		n_expired = pkth_inst->takeExpiredRequests(expired, ARRAY_SIZE(expired),
+							   &next_deadline);
+
+		for (int i = 0; i < n_expired; i++) {
+			LOG_WRN("Request %u to %d timed out", expired[i].id, expired[i].dest_id);
+
+			cs_packet_buf *buf = pkth_inst->allocBuffer(K_NO_WAIT);
+			if (buf == NULL) {
+				continue;
 			}
-		} else {
-			LOG_WRN("%s", "Failed to retrieve message from message queue");
+			buf->type = CS_DATA_OUTGOING;
+			buf->src_id = expired[i].dest_id;
+			buf->dest_id = expired[i].src_id;
+			buf->result = true;
+			buf->result_code = CS_RESULT_TYPE_TIMEOUT;
+			buf->command_type = expired[i].type;
+			buf->request_id = expired[i].id;
+
+			pkth_inst->handlePacket(buf);
 		}
+	} while (n_expired == ARRAY_SIZE(expired));
+
+	// check again once the first of the remaining requests expires
+	if (next_deadline > 0) {
+		k_work_schedule(dwork, K_MSEC(MAX(next_deadline - k_uptime_get(), 0)));
 	}
 }
 
@@ -298,9 +581,27 @@ cs_ret_code_t PacketHandler::init()
 		return CS_ERR_ALREADY_INITIALIZED;
 	}
 
+	// the pool may already be initialized when multiple handlers are used
+	cs_ret_code_t ret = PacketBufferPool::getInstance()->init();
+	if (ret != CS_OK && ret != CS_ERR_ALREADY_INITIALIZED) {
+		return ret;
+	}
+
 	k_mutex_init(&_pkth_mtx);
-	// initialize message queue, aligned to 4-byte boundary
-	k_msgq_init(&_pkth_msgq, _msgq_buf, sizeof(cs_packet_data), CS_PACKET_BUF_SIZE);
+	k_sem_init(&_pkth_sem, 0, K_SEM_MAX_LIMIT);
+	for (int i = 0; i < CS_PACKET_HANDLERS; i++) {
+		k_sem_init(&_handler_released[i], 0, 1);
+	}
+	// a full control lane rejects new packets, so they are never silently replaced
+	_ctrl_queue.init(CS_PACKET_CTRL_QUEUE_SIZE, CS_PACKET_QUEUE_DROP_NEWEST);
+	// a full data lane drops the oldest data, the newest data is the most relevant
+	_data_queue.init(CS_PACKET_DATA_QUEUE_SIZE, CS_PACKET_QUEUE_DROP_OLDEST);
+
+	_batch.init();
+
+	memset(_requests, 0, sizeof(_requests));
+	_req_timer.inst = this;
+	k_work_init_delayable(&_req_timer.work, handleRequestTimeouts);
 
 	// create thread for handling uart messages
 	k_tid_t uart_thread = k_thread_create(
@@ -318,33 +619,42 @@ cs_ret_code_t PacketHandler::init()
  * @param inst_id Instance ID of the destination instance that should handle the data.
  * @param inst Pointer to class instance according to destination ID.
  * @param cb Function pointer to function that should be called to transport the data.
+ * @param work_q Work queue the transport function should run on, so a slow transport can't delay
+ * others. NULL to use the system work queue.
  */
 cs_ret_code_t PacketHandler::registerHandler(cs_router_instance_id inst_id, void *inst,
-					     k_work_handler_t cb)
+					     k_work_handler_t cb, k_work_q *work_q)
 {
 	if (!_initialized) {
 		LOG_ERR("%s", "Not initialized");
 		return CS_ERR_NOT_INITIALIZED;
 	}
 
+	if (inst_id >= CS_PACKET_HANDLERS) {
+		LOG_ERR("Invalid handler ID %d", inst_id);
+		return CS_ERR_INVALID_PARAM;
+	}
+
 	k_mutex_lock(&_pkth_mtx, K_FOREVER);
 
-	for (int i = 0; i < _handler_ctr; i++) {
-		if (_handlers[i].id == inst_id) {
-			LOG_ERR("Handler with ID %d already registered", inst_id);
-			return CS_ERR_PACKET_HANDLER_ALREADY_REGISTERED;
-		}
+	if (atomic_test_bit(_handler_map, inst_id) || atomic_test_bit(_handler_closing, inst_id)) {
+		k_mutex_unlock(&_pkth_mtx);
+		LOG_ERR("Handler with ID %d already registered", inst_id);
+		return CS_ERR_PACKET_HANDLER_ALREADY_REGISTERED;
 	}
-	// create a new handler
-	cs_packet_handler handler;
-	memset(&handler, 0, sizeof(handler));
-	handler.id = inst_id;
-	handler.target_inst = inst;
 
-	k_work_init(&handler.work_item, cb);
+	// the slot is cleared when unregistered, and no lookups use it until it is published
+	cs_packet_handler *handler = &_handlers[inst_id];
+	handler->id = inst_id;
+	handler->target_inst = inst;
+	handler->work_q = work_q != NULL ? work_q : &k_sys_work_q;
+	handler->tx_queue.init(CS_PACKET_HANDLER_QUEUE_SIZE, CS_PACKET_QUEUE_DROP_NEWEST);
+
+	k_work_init(&handler->work_item, cb);
+	handler->active = true;
 
-	// store handler
-	memcpy(&_handlers[_handler_ctr++], &handler, sizeof(handler));
+	// publish the handler, atomic operations act as a full memory barrier
+	atomic_set_bit(_handler_map, inst_id);
 
 	k_mutex_unlock(&_pkth_mtx);
 
@@ -352,7 +662,8 @@ cs_ret_code_t PacketHandler::registerHandler(cs_router_instance_id inst_id, void
 }
 
 /**
- * @brief Unregister a registered data handler.
+ * @brief Unregister a registered data handler. Waits till the lookups that still use the handler
+ * released it, and till a transport that is already running finished.
  *
  * @param inst_id Instance ID that was registered for handling data.
  */
@@ -363,73 +674,483 @@ cs_ret_code_t PacketHandler::unregisterHandler(cs_router_instance_id inst_id)
 		return CS_ERR_NOT_INITIALIZED;
 	}
 
+	if (inst_id >= CS_PACKET_HANDLERS) {
+		LOG_ERR("Invalid handler ID %d", inst_id);
+		return CS_ERR_INVALID_PARAM;
+	}
+
 	k_mutex_lock(&_pkth_mtx, K_FOREVER);
 
-	for (int i = 0; i < _handler_ctr; i++) {
-		if (_handlers[i].id == inst_id) {
-			// clean from register by shifting next data to removed slot
-			for (int j = (i - 1); i < (_handler_ctr - 1); i++) {
-				_handlers[j] = _handlers[j + 1];
-			}
-			_handler_ctr--;
-			return CS_OK;
-		}
+	// unpublish first, so no new lookups can use the slot. The slot stays reserved for this
+	// handler until it is cleared, as the mutex isn't held while waiting
+	k_sem_reset(&_handler_released[inst_id]);
+	if (!atomic_test_and_clear_bit(_handler_map, inst_id)) {
+		k_mutex_unlock(&_pkth_mtx);
+		LOG_ERR("Could not find handler for ID %d", inst_id);
+		return CS_ERR_PACKET_HANDLER_NOT_FOUND;
 	}
+	atomic_set_bit(_handler_closing, inst_id);
+
 	k_mutex_unlock(&_pkth_mtx);
 
-	LOG_ERR("Could not find input handler for ID %d", inst_id);
+	cs_packet_handler *handler = &_handlers[inst_id];
+
+	// wait for the lookups that found the handler before it was unpublished
+	while (atomic_get(&_handler_users[inst_id]) > 0) {
+		k_sem_take(&_handler_released[inst_id], K_FOREVER);
+	}
+
+	// the batch holds on to its handler until the batch is sent
+	if (inst_id == CS_PACKET_BATCH_DEST_ID) {
+		k_work_sync batch_sync;
+		_batch.flush();
+		k_work_cancel_delayable_sync(&_batch._flush_work, &batch_sync);
+	}
+
+	// a transport completing a packet from an ISR can't schedule the work item anymore
+	k_spinlock_key_t key = k_spin_lock(&handler->lock);
+	handler->active = false;
+	k_spin_unlock(&handler->lock, key);
+
+	// a transport that is already running has to finish before the slot can be cleared
+	k_work_sync sync;
+	k_work_cancel_sync(&handler->work_item, &sync);
+	handler->tx_queue.purge();
+	memset(handler, 0, sizeof(*handler));
+
+	atomic_clear_bit(_handler_closing, inst_id);
 
-	return CS_ERR_PACKET_HANDLER_NOT_FOUND;
+	return CS_OK;
 }
 
 /**
- * @brief Get an output handler by it's target ID. Used by the input handler
- * to pass data to peripherals.
+ * @brief Get an output handler by it's target ID. The lookup is lock-free and can be used from any
+ * context. The handler can be cleared as soon as it is unregistered, so only keep the pointer when
+ * the caller owns the registration, use acquireHandler() otherwise.
  *
  * @param inst_id Instance ID of the destination instance that should handle the data.
+ *
+ * @return Pointer to the handler, or NULL if no handler is registered for the ID.
  */
 cs_packet_handler *PacketHandler::getHandler(cs_router_instance_id inst_id)
 {
-	if (!_initialized) {
-		LOG_ERR("%s", "Not initialized");
+	if (inst_id >= CS_PACKET_HANDLERS || !atomic_test_bit(_handler_map, inst_id)) {
 		return NULL;
 	}
 
-	for (int i = 0; i < _handler_ctr; i++) {
-		if (_handlers[i].id == inst_id) {
-			return &_handlers[i];
+	return &_handlers[inst_id];
+}
+
+/**
+ * @brief Get an output handler by it's target ID, and keep it from being cleared until it is
+ * released with releaseHandler(). Use this instead of getHandler() when the handler is used after
+ * the lookup. Lock-free, can be used from any context.
+ *
+ * @param inst_id Instance ID of the destination instance that should handle the data.
+ *
+ * @return Pointer to the handler, or NULL if no handler is registered for the ID.
+ */
+cs_packet_handler *PacketHandler::acquireHandler(cs_router_instance_id inst_id)
+{
+	if (inst_id >= CS_PACKET_HANDLERS) {
+		return NULL;
+	}
+
+	// count the user before checking the map, unregisterHandler() does the reverse
+	atomic_inc(&_handler_users[inst_id]);
+	if (!atomic_test_bit(_handler_map, inst_id)) {
+		// the handler may be unregistered while it was counted
+		if (atomic_dec(&_handler_users[inst_id]) == 1) {
+			k_sem_give(&_handler_released[inst_id]);
 		}
+		return NULL;
 	}
-	LOG_ERR("Could not find handler for ID %d", inst_id);
-	return NULL;
+
+	return &_handlers[inst_id];
 }
 
 /**
- * @brief Handle packet by calling the associated callback for an instance.
+ * @brief Release a handler that was acquired with acquireHandler().
  *
- * @param data Structure with packet data. One of @ref cs_packet_data
+ * @param hdlr Handler to release, can be NULL.
+ */
+void PacketHandler::releaseHandler(cs_packet_handler *hdlr)
+{
+	if (hdlr == NULL) {
+		return;
+	}
+
+	// the last user of a handler that is being unregistered wakes unregisterHandler()
+	int inst_id = hdlr - _handlers;
+	if (atomic_dec(&_handler_users[inst_id]) == 1 && !atomic_test_bit(_handler_map, inst_id)) {
+		k_sem_give(&_handler_released[inst_id]);
+	}
+}
+
+/**
+ * @brief Allocate a packet buffer from the shared pool, to be filled by a transport.
+ *
+ * @param timeout Time to wait for a buffer, use K_NO_WAIT from an ISR.
+ *
+ * @return Pointer to the buffer, or NULL if none was available.
+ */
+cs_packet_buf *PacketHandler::allocBuffer(k_timeout_t timeout)
+{
+	if (!_initialized) {
+		LOG_ERR("%s", "Not initialized");
+		return NULL;
+	}
+
+	return PacketBufferPool::getInstance()->alloc(timeout);
+}
+
+/**
+ * @brief Handle packet by passing the buffer to the packet handler thread.
+ * The reference to the buffer is always consumed, also when handling fails.
+ *
+ * @param buf Packet buffer with the packet data and routing information.
  *
  * @return CS_OK if the packet was dispatched successfully.
  */
-cs_ret_code_t PacketHandler::handlePacket(cs_packet_data *data)
+cs_ret_code_t PacketHandler::handlePacket(cs_packet_buf *buf)
 {
 	if (!_initialized) {
 		LOG_ERR("%s", "Not initialized");
+		PacketBufferPool::unref(buf);
 		return CS_ERR_NOT_INITIALIZED;
 	}
 
 	// check if the thread is still running
 	if (k_thread_join(&_pkth_tid, K_NO_WAIT) == 0) {
 		LOG_ERR("%s", "Packet handler thread is not running, exiting.");
+		PacketBufferPool::unref(buf);
 		return CS_ERR_ABORTED;
 	}
 
-	// dispatch the packet data to be handled later (async)
+	buf->enqueue_cyc = k_cycle_get_32();
+
+	cs_packet_handler *src = acquireHandler(buf->src_id);
+	if (src != NULL) {
+		atomic_inc(&src->stats.pkts_in);
+		atomic_add(&src->stats.bytes_in, buf->len);
+		releaseHandler(src);
+	}
+
+	// incoming packets are control packets, outgoing packets answering a pending request
+	// become result packets, those go in the control lane. Everything else is data.
+	PacketQueue *lane = &_data_queue;
+	if (buf->type == CS_DATA_INCOMING) {
+		lane = &_ctrl_queue;
+	} else if (buf->result || (!buf->unsolicited && hasRequest(buf->src_id))) {
+		lane = &_ctrl_queue;
+	}
+
+	// dispatch the buffer pointer to be handled later (async)
 	// don't wait till space becomes available, as it can cause deadlocks
-	if (k_msgq_put(&_pkth_msgq, data, K_NO_WAIT) != 0) {
-		LOG_WRN("%s", "Failed to submit message to packet handler queue, queue is full");
+	if (lane->put(buf) != CS_OK) {
+		LOG_WRN("%s", "Failed to submit packet to packet handler, control lane is full");
 		return CS_ERR_PACKET_HANDLER_NOT_READY;
-	};
+	}
+	k_sem_give(&_pkth_sem);
+
+	return CS_OK;
+}
+
+/**
+ * @brief Add a packet to the transmit queue of a handler and schedule its transport work item.
+ *
+ * @param hdlr Handler of the destination.
+ * @param buf Packet buffer, the reference is moved to the handler.
+ *
+ * @return CS_OK if the packet was queued, CS_ERR_PACKET_QUEUE_FULL if it was dropped,
+ * CS_ERR_PACKET_HANDLER_NOT_FOUND if the handler is being unregistered.
+ */
+cs_ret_code_t PacketHandler::putPacket(cs_packet_handler *hdlr, cs_packet_buf *buf)
+{
+	k_spinlock_key_t key = k_spin_lock(&hdlr->lock);
+
+	if (!hdlr->active) {
+		k_spin_unlock(&hdlr->lock, key);
+		PacketBufferPool::unref(buf);
+		return CS_ERR_PACKET_HANDLER_NOT_FOUND;
+	}
+
+	// the buffer can't be used after it is queued, as the transport may already release it
+	uint32_t enqueue_cyc = buf->enqueue_cyc;
+	buf->dispatch_cyc = k_cycle_get_32();
+
+	cs_ret_code_t ret = hdlr->tx_queue.put(buf);
+	// a packet dropped by a full queue was never queued, so it has no queue latency
+	if (ret == CS_OK) {
+		recordLatency(hdlr->stats.dispatch_latency, enqueue_cyc);
+	}
+	k_work_submit_to_queue(hdlr->work_q, &hdlr->work_item);
+
+	k_spin_unlock(&hdlr->lock, key);
+
+	if (ret != CS_OK) {
+		LOG_WRN("Transmit queue of handler %d is full, packet dropped", hdlr->id);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Take the next packet from the transmit queue of a handler.
+ * Used by the transport work items, which should handle one packet per run.
+ *
+ * @param hdlr Handler of the destination.
+ *
+ * @return The packet buffer, the caller owns the reference. NULL if no packet was pending.
+ */
+cs_packet_buf *PacketHandler::takePacket(cs_packet_handler *hdlr)
+{
+	cs_packet_buf *buf = hdlr->tx_queue.get();
+
+	if (buf != NULL) {
+		atomic_inc(&hdlr->stats.pkts_out);
+		atomic_add(&hdlr->stats.bytes_out, buf->len);
+		recordLatency(hdlr->stats.send_latency, buf->dispatch_cyc);
+	}
+
+	return buf;
+}
+
+/**
+ * @brief Schedule the transport work item, unless the handler is being unregistered.
+ * Can be called from an ISR.
+ *
+ * @param hdlr Handler of the destination.
+ */
+void PacketHandler::schedule(cs_packet_handler *hdlr)
+{
+	k_spinlock_key_t key = k_spin_lock(&hdlr->lock);
+
+	if (hdlr->active) {
+		k_work_submit_to_queue(hdlr->work_q, &hdlr->work_item);
+	}
+
+	k_spin_unlock(&hdlr->lock, key);
+}
+
+/**
+ * @brief Schedule the transport work item again if packets are still queued.
+ * Called by a transport once it is done with a packet. Can be called from an ISR.
+ *
+ * @param hdlr Handler of the destination.
+ */
+void PacketHandler::scheduleNext(cs_packet_handler *hdlr)
+{
+	if (hdlr->tx_queue.count() > 0) {
+		schedule(hdlr);
+	}
+}
+
+/**
+ * @brief Register a request that awaits a result. A request with the same destination and
+ * request id replaces the existing one.
+ *
+ * @param ctrl_pkt Control packet of the request.
+ * @param src_id Instance the request came from, the result is sent back to it.
+ *
+ * @return CS_OK if the request was registered.
+ */
+cs_ret_code_t PacketHandler::addRequest(cs_router_control_packet *ctrl_pkt,
+					cs_router_instance_id src_id)
+{
+	cs_packet_request *slot = NULL;
+
+	k_spinlock_key_t key = k_spin_lock(&_req_lock);
+
+	for (int i = 0; i < CS_PACKET_PENDING_REQUESTS; i++) {
+		cs_packet_request *req = &_requests[i];
+		if (req->in_use && req->dest_id == ctrl_pkt->dest_id &&
+		    req->id == ctrl_pkt->request_id) {
+			slot = req;
+			break;
+		}
+		if (!req->in_use && slot == NULL) {
+			slot = req;
+		}
+	}
+
+	if (slot != NULL) {
+		slot->in_use = true;
+		slot->type = (cs_router_command_type)ctrl_pkt->command_type;
+		slot->dest_id = (cs_router_instance_id)ctrl_pkt->dest_id;
+		slot->src_id = src_id;
+		slot->id = ctrl_pkt->request_id;
+		slot->seq = _req_seq++;
+		slot->deadline = k_uptime_get() + CS_PACKET_REQUEST_TIMEOUT_MS;
+	}
+
+	k_spin_unlock(&_req_lock, key);
+
+	if (slot == NULL) {
+		LOG_WRN("Too many pending requests, result for request %u is not tracked",
+			ctrl_pkt->request_id);
+		return CS_ERR_PACKET_QUEUE_FULL;
+	}
+
+	// has no effect if the check is already scheduled, which is always earlier
+	k_work_schedule(&_req_timer.work, K_MSEC(CS_PACKET_REQUEST_TIMEOUT_MS));
+
+	return CS_OK;
+}
+
+/**
+ * @brief Take the pending request a packet from a destination is the result of.
+ *
+ * @param dest_id Instance the packet comes from, which is the destination of the request.
+ * @param request_id Request id the packet belongs to if known by the transport, else 0.
+ * The oldest pending request of the destination is used when 0.
+ * @param req Structure the request is copied to.
+ *
+ * @return True if a matching request was found and removed.
+ */
+bool PacketHandler::takeRequest(cs_router_instance_id dest_id, uint16_t request_id,
+				cs_packet_request *req)
+{
+	cs_packet_request *match = NULL;
+
+	k_spinlock_key_t key = k_spin_lock(&_req_lock);
+
+	for (int i = 0; i < CS_PACKET_PENDING_REQUESTS; i++) {
+		cs_packet_request *entry = &_requests[i];
+		if (!entry->in_use || entry->dest_id != dest_id) {
+			continue;
+		}
+		if (request_id > 0) {
+			if (entry->id == request_id) {
+				match = entry;
+				break;
+			}
+		} else if (match == NULL || (int32_t)(entry->seq - match->seq) < 0) {
+			match = entry;
+		}
+	}
+
+	if (match != NULL) {
+		*req = *match;
+		match->in_use = false;
+	}
+
+	k_spin_unlock(&_req_lock, key);
+
+	return match != NULL;
+}
+
+/**
+ * @brief Check whether a destination has requests awaiting a result.
+ */
+bool PacketHandler::hasRequest(cs_router_instance_id dest_id)
+{
+	bool found = false;
+
+	k_spinlock_key_t key = k_spin_lock(&_req_lock);
+
+	for (int i = 0; i < CS_PACKET_PENDING_REQUESTS; i++) {
+		if (_requests[i].in_use && _requests[i].dest_id == dest_id) {
+			found = true;
+			break;
+		}
+	}
+
+	k_spin_unlock(&_req_lock, key);
+
+	return found;
+}
+
+/**
+ * @brief Take all requests of which the deadline has passed.
+ *
+ * @param reqs Array the expired requests are copied to.
+ * @param max_reqs Size of the array.
+ * @param next_deadline Set to the earliest deadline of the remaining requests, 0 if there are
+ * none left.
+ *
+ * @return Amount of expired requests.
+ */
+int PacketHandler::takeExpiredRequests(cs_packet_request *reqs, int max_reqs,
+				       int64_t *next_deadline)
+{
+	int n_expired = 0;
+	int64_t now = k_uptime_get();
+
+	*next_deadline = 0;
+
+	k_spinlock_key_t key = k_spin_lock(&_req_lock);
+
+	for (int i = 0; i < CS_PACKET_PENDING_REQUESTS; i++) {
+		cs_packet_request *entry = &_requests[i];
+		if (!entry->in_use) {
+			continue;
+		}
+		if (entry->deadline <= now && n_expired < max_reqs) {
+			reqs[n_expired++] = *entry;
+			entry->in_use = false;
+		} else if (*next_deadline == 0 || entry->deadline < *next_deadline) {
+			*next_deadline = entry->deadline;
+		}
+	}
+
+	k_spin_unlock(&_req_lock, key);
+
+	return n_expired;
+}
+
+/**
+ * @brief Get the packet statistics of an instance.
+ *
+ * @param inst_id Instance to get the statistics of, @ref CS_INSTANCE_ID_ESP32 for the totals over
+ * all instances.
+ * @param stats Structure the statistics are copied to.
+ *
+ * @return CS_OK if the statistics were copied, CS_ERR_PACKET_HANDLER_NOT_FOUND if no handler is
+ * registered for the instance.
+ */
+cs_ret_code_t PacketHandler::getStats(cs_router_instance_id inst_id,
+				      cs_router_packet_stats_packet *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (inst_id != CS_INSTANCE_ID_ESP32 && getHandler(inst_id) == NULL) {
+		return CS_ERR_PACKET_HANDLER_NOT_FOUND;
+	}
+
+	for (int id = 0; id < CS_PACKET_HANDLERS; id++) {
+		if (inst_id != CS_INSTANCE_ID_ESP32 && id != inst_id) {
+			continue;
+		}
+		cs_packet_handler *hdlr = acquireHandler((cs_router_instance_id)id);
+		if (hdlr == NULL) {
+			continue;
+		}
+
+		stats->pkts_in += atomic_get(&hdlr->stats.pkts_in);
+		stats->bytes_in += atomic_get(&hdlr->stats.bytes_in);
+		stats->pkts_out += atomic_get(&hdlr->stats.pkts_out);
+		stats->bytes_out += atomic_get(&hdlr->stats.bytes_out);
+		for (int i = 0; i < CS_PACKET_STATS_LATENCY_BUCKETS; i++) {
+			stats->dispatch_latency[i] += atomic_get(&hdlr->stats.dispatch_latency[i]);
+			stats->send_latency[i] += atomic_get(&hdlr->stats.send_latency[i]);
+		}
+
+		if (inst_id != CS_INSTANCE_ID_ESP32) {
+			cs_packet_queue_stats q_stats = hdlr->tx_queue.getStats();
+			stats->drops = q_stats.drops;
+			stats->queue_high_water = q_stats.high_water;
+		}
+		releaseHandler(hdlr);
+	}
+
+	// the controller itself reports the lanes of the packet handler
+	if (inst_id == CS_INSTANCE_ID_ESP32) {
+		cs_packet_queue_stats ctrl_stats = _ctrl_queue.getStats();
+		cs_packet_queue_stats data_stats = _data_queue.getStats();
+		stats->drops = ctrl_stats.drops + data_stats.drops;
+		stats->queue_high_water = MAX(ctrl_stats.high_water, data_stats.high_water);
+	}
 
 	return CS_OK;
 }
\ No newline at end of file
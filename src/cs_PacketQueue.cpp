@@ -0,0 +1,142 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#include "cs_PacketQueue.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(cs_PacketQueue, LOG_LEVEL_INF);
+
+#include <string.h>
+
+/**
+ * @brief Initialize the queue.
+ *
+ * @param size Maximum amount of packets in the queue, at most @ref CS_PACKET_QUEUE_MAX_SIZE.
+ * @param policy What to do when a packet is added to a full queue, one of
+ * @ref cs_packet_queue_policy.
+ */
+void PacketQueue::init(uint8_t size, cs_packet_queue_policy policy)
+{
+	memset(_bufs, 0, sizeof(_bufs));
+	memset(&_stats, 0, sizeof(_stats));
+	memset(&_lock, 0, sizeof(_lock));
+	_size = CLAMP(size, 1, CS_PACKET_QUEUE_MAX_SIZE);
+	_head = 0;
+	_count = 0;
+	_policy = policy;
+	_full = false;
+}
+
+/**
+ * @brief Add a packet to the back of the queue. The reference to the buffer is always consumed.
+ *
+ * @param buf Packet buffer to add.
+ *
+ * @return CS_OK if the packet was added, CS_ERR_PACKET_QUEUE_FULL if it was dropped.
+ */
+cs_ret_code_t PacketQueue::put(cs_packet_buf *buf)
+{
+	cs_packet_buf *dropped = NULL;
+	cs_ret_code_t ret = CS_OK;
+
+	k_spinlock_key_t key = k_spin_lock(&_lock);
+
+	if (_count == _size) {
+		// a queue that stays full counts as a single overflow
+		if (!_full) {
+			_stats.overflows++;
+			_full = true;
+		}
+		_stats.drops++;
+
+		if (_policy == CS_PACKET_QUEUE_DROP_OLDEST) {
+			dropped = _bufs[_head];
+			_head = (_head + 1) % _size;
+			_count--;
+		} else {
+			dropped = buf;
+			ret = CS_ERR_PACKET_QUEUE_FULL;
+		}
+	}
+
+	if (ret == CS_OK) {
+		_bufs[(_head + _count) % _size] = buf;
+		_count++;
+		_stats.high_water = MAX(_stats.high_water, _count);
+	}
+
+	k_spin_unlock(&_lock, key);
+
+	// release outside of the lock
+	PacketBufferPool::unref(dropped);
+
+	return ret;
+}
+
+/**
+ * @brief Take the oldest packet from the queue.
+ *
+ * @return The packet buffer, the caller owns the reference. NULL if the queue is empty.
+ */
+cs_packet_buf *PacketQueue::get()
+{
+	cs_packet_buf *buf = NULL;
+
+	k_spinlock_key_t key = k_spin_lock(&_lock);
+
+	if (_count > 0) {
+		buf = _bufs[_head];
+		_bufs[_head] = NULL;
+		_head = (_head + 1) % _size;
+		_count--;
+		_full = false;
+	}
+
+	k_spin_unlock(&_lock, key);
+
+	return buf;
+}
+
+/**
+ * @brief Get the amount of packets in the queue.
+ */
+uint8_t PacketQueue::count()
+{
+	k_spinlock_key_t key = k_spin_lock(&_lock);
+	uint8_t count = _count;
+	k_spin_unlock(&_lock, key);
+
+	return count;
+}
+
+/**
+ * @brief Drop all packets in the queue, they are counted as drops.
+ */
+void PacketQueue::purge()
+{
+	cs_packet_buf *buf;
+
+	while ((buf = get()) != NULL) {
+		k_spinlock_key_t key = k_spin_lock(&_lock);
+		_stats.drops++;
+		k_spin_unlock(&_lock, key);
+
+		PacketBufferPool::unref(buf);
+	}
+}
+
+/**
+ * @brief Get a snapshot of the queue statistics.
+ */
+cs_packet_queue_stats PacketQueue::getStats()
+{
+	k_spinlock_key_t key = k_spin_lock(&_lock);
+	cs_packet_queue_stats stats = _stats;
+	k_spin_unlock(&_lock, key);
+
+	return stats;
+}
\ No newline at end of file
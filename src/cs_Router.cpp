@@ -6,20 +6,21 @@
  */
 
 #include "drivers/cs_Uart.h"
+#include "drivers/cs_ModbusMaster.h"
+#include "drivers/cs_P1Parser.h"
 #include "drivers/cs_Wifi.h"
 #include "drivers/ble/cs_BleCentral.h"
 #include "socket/cs_WebSocket.h"
 #include "cs_ReturnTypes.h"
 #include "cs_PacketHandling.h"
 #include "cs_RouterProtocol.h"
+#include "cs_Crc16.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(cs_Router, LOG_LEVEL_INF);
 
 #include <zephyr/device.h>
 
-#define RS485_DEVICE DT_NODELABEL(uart2)
-
 #define TEST_SSID "ssid"
 #define TEST_PSK  "psk"
 
@@ -28,10 +29,21 @@ LOG_MODULE_REGISTER(cs_Router, LOG_LEVEL_INF);
 
 #define CROWNSTONE_UUID "24f000007d104805bfc17663a01c3bff"
 
+// values read from the smart meter on RS232: energy delivered and returned per tariff, power
+// delivered and returned, and the gas meter reading
+static const cs_p1_obis p1_obis[] = {
+	{{1, 0, 1, 8, 1}}, {{1, 0, 1, 8, 2}}, {{1, 0, 2, 8, 1}}, {{1, 0, 2, 8, 2}},
+	{{1, 0, 1, 7, 0}}, {{1, 0, 2, 7, 0}}, {{0, 1, 24, 2, 1}},
+};
+
 int main(void)
 {
 	cs_ret_code_t ret = CS_OK;
 
+#ifdef CS_CRC16_BENCHMARK
+	cs_crc16_ccitt_benchmark();
+#endif
+
 	PacketHandler pkt_handler;
 	ret |= pkt_handler.init();
 
@@ -46,24 +58,61 @@ int main(void)
 	// wait till wifi connection is established before creating websocket
 	ret |= wifi->waitConnected(SYS_FOREVER_MS);
 
+#ifdef CS_WEBSOCKET_BENCHMARK
+	cs_websocket_benchmark(CS_WEBSOCKET_BENCHMARK_HOST, CS_WEBSOCKET_BENCHMARK_PORT);
+#endif
+
 	WebSocket web_socket(CS_INSTANCE_ID_CLOUD, &pkt_handler);
 	ret |= web_socket.init(HOST_ADDR, CS_SOCKET_IPV4, HOST_PORT);
+	// the handler only queues packets, they are sent by the connection thread of the websocket
+	ret |= web_socket.connect(NULL);
 	ret |= pkt_handler.registerHandler(CS_INSTANCE_ID_CLOUD, &web_socket,
 					   WebSocket::sendMessage);
-	ret |= web_socket.connect(NULL);
 
 	BleCentral *ble = BleCentral::getInstance();
 	ble->setSourceId(CS_INSTANCE_ID_BLE_CROWNSTONE_PERIPHERAL);
 	ble->setDestinationId(CS_INSTANCE_ID_CLOUD);
 	ret |= ble->init(CROWNSTONE_UUID, &pkt_handler);
-	ret |= pkt_handler.registerHandler(CS_INSTANCE_ID_BLE_CROWNSTONE_PERIPHERAL, &ble,
-					   BleCentral::sendBleMessage);
+	ret |= pkt_handler.registerHandler(CS_INSTANCE_ID_BLE_CROWNSTONE_PERIPHERAL, ble,
+					   BleCentral::sendBleMessage, &ble->_ble_workq);
+
+	// UART instances are declared in devicetree, e.g. RS485, RS232 and CM4
+	Uart *modbus_uart = NULL;
+	Uart *rs232 = NULL;
+	for (int i = 0; i < Uart::getInstanceCount(); i++) {
+		Uart *uart = Uart::getInstance(i);
+		ret |= uart->init(NULL, &pkt_handler);
+		ret |= pkt_handler.registerHandler(uart->_src_id, uart, Uart::sendUartMessage,
+						   &uart->_uart_workq);
+		if (uart->_cfg->modbus_polls_len > 0 && modbus_uart == NULL) {
+			modbus_uart = uart;
+		}
+		if (uart->_src_id == CS_INSTANCE_ID_UART_RS232) {
+			rs232 = uart;
+		}
+	}
 
-	const device *rs485_dev = DEVICE_DT_GET(RS485_DEVICE);
-	Uart rs485(rs485_dev, CS_INSTANCE_ID_UART_RS485, CS_INSTANCE_ID_CLOUD, &pkt_handler);
-	ret |= rs485.init(NULL);
-	ret |= pkt_handler.registerHandler(CS_INSTANCE_ID_UART_RS485, &rs485,
-					   Uart::sendUartMessage);
+	// slaves are only polled if a UART has a Modbus poll schedule in devicetree, their readings
+	// are sent to the destination of the UART
+	ModbusMaster modbus;
+	if (modbus_uart != NULL) {
+		const uint32_t *polls = modbus_uart->_cfg->modbus_polls;
+		size_t len = modbus_uart->_cfg->modbus_polls_len;
+		ret |= modbus.init(modbus_uart, &pkt_handler);
+		for (size_t i = 0; i < len; i += CS_UART_MODBUS_POLL_CELLS) {
+			ret |= modbus.addPoll(polls[i], (cs_modbus_function)polls[i + 1],
+					      polls[i + 2], polls[i + 3], polls[i + 4]);
+		}
+	}
+
+	// telegrams of the smart meter on RS232 are reduced to the values of interest
+	P1Parser p1;
+	if (rs232 != NULL) {
+		for (size_t i = 0; i < ARRAY_SIZE(p1_obis); i++) {
+			ret |= p1.addObis(&p1_obis[i]);
+		}
+		ret |= p1.init(rs232, &pkt_handler);
+	}
 
 	if (ret) {
 		LOG_ERR("Failed to initialize router (err %d)", ret);
@@ -76,7 +125,9 @@ int main(void)
 	// then wait for other threads to terminate
 	ret |= k_thread_join(&pkt_handler._pkth_tid, K_FOREVER);
 	ret |= k_thread_join(&web_socket._ws_tid, K_FOREVER);
-	ret |= k_thread_join(&rs485._uart_tid, K_FOREVER);
+	for (int i = 0; i < Uart::getInstanceCount(); i++) {
+		ret |= k_thread_join(&Uart::getInstance(i)->_uart_tid, K_FOREVER);
+	}
 	if (ret) {
 		return EXIT_FAILURE;
 	}
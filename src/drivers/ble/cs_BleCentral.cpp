@@ -13,6 +13,8 @@ LOG_MODULE_REGISTER(cs_BleCentral, LOG_LEVEL_INF);
 
 #include <zephyr/kernel.h>
 
+K_THREAD_STACK_DEFINE(ble_workq_stack_area, CS_BLE_CENTRAL_WORKQ_STACK_SIZE);
+
 /**
  * @brief Handle notifications.
  */
@@ -28,34 +30,37 @@ static uint8_t handleNotifications(bt_conn *conn, bt_gatt_subscribe_params *para
 	uint8_t *part = (uint8_t *)data;
 	uint8_t counter = part[0];
 
-	if ((ble_inst->_ble_buf_ctr + length - 1U) > sizeof(ble_inst->_ble_buf)) {
-		LOG_ERR("%s", "Failed to parse notification, length exceeds buffer size");
+	// notification chunks are written directly into a packet buffer
+	if (ble_inst->_rx_buf == NULL && ble_inst->_pkt_handler != NULL) {
+		ble_inst->_rx_buf = ble_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
+	}
+	if (ble_inst->_rx_buf == NULL) {
+		LOG_ERR("%s", "Failed to parse notification, no buffer available");
 		return BT_GATT_ITER_STOP;
 	}
+
 	// add data to buffer, notification comes in chunks (first byte is counter)
-	memcpy(ble_inst->_ble_buf + ble_inst->_ble_buf_ctr, part + 1, length - 1);
-	ble_inst->_ble_buf_ctr += length - 1;
+	uint8_t *chunk = PacketBufferPool::add(ble_inst->_rx_buf, length - 1);
+	if (chunk == NULL) {
+		LOG_ERR("%s", "Failed to parse notification, length exceeds buffer size");
+		return BT_GATT_ITER_STOP;
+	}
+	memcpy(chunk, part + 1, length - 1);
 
 	if (counter == UINT8_MAX) {
-		LOG_HEXDUMP_DBG(ble_inst->_ble_buf, ble_inst->_ble_buf_ctr, "Notification");
-
-		cs_packet_data ble_notif_data;
-		memset(&ble_notif_data, 0, sizeof(ble_notif_data));
-		ble_notif_data.msg.buf_len = ble_inst->_ble_buf_ctr;
-		ble_notif_data.src_id = ble_inst->_src_id;
-		ble_notif_data.dest_id = ble_inst->_dest_id;
-		ble_notif_data.type = CS_DATA_OUTGOING;
-		ble_notif_data.result_code = CS_RESULT_TYPE_SUCCES;
-		memcpy(&ble_notif_data.msg.buf, ble_inst->_ble_buf, ble_inst->_ble_buf_ctr);
-
-		if (ble_inst->_pkt_handler != NULL) {
-			// data is copied into work handler, so we don't have to save the struct
-			ble_inst->_pkt_handler->handlePacket(&ble_notif_data);
-		} else {
-			LOG_WRN("%s", "Failed to handle BLE notification");
-		}
+		cs_packet_buf *buf = ble_inst->_rx_buf;
+		ble_inst->_rx_buf = NULL;
+
+		LOG_HEXDUMP_DBG(buf->data, buf->len, "Notification");
+
+		buf->src_id = ble_inst->_src_id;
+		buf->dest_id = ble_inst->_dest_id;
+		buf->type = CS_DATA_OUTGOING;
+		buf->result_code = CS_RESULT_TYPE_SUCCES;
+
+		// the reference to the buffer is moved to the handler
+		ble_inst->_pkt_handler->handlePacket(buf);
 
-		ble_inst->_ble_buf_ctr = 0;
 		ble_inst->disconnect();
 		return BT_GATT_ITER_STOP;
 	}
@@ -184,6 +189,15 @@ static uint8_t handleDiscoveryResults(bt_conn *conn, const bt_gatt_attr *attr,
  */
 static void handleWriteResult(bt_conn *conn, uint8_t err, bt_gatt_write_params *params)
 {
+	BleCentral *ble_inst = BleCentral::getInstance();
+
+	// the written data is no longer needed, continue with the next queued packet
+	PacketBufferPool::unref(ble_inst->_tx_buf);
+	ble_inst->_tx_buf = NULL;
+	if (ble_inst->_tx_hdlr != NULL) {
+		PacketHandler::scheduleNext(ble_inst->_tx_hdlr);
+	}
+
 	char dev[BT_ADDR_LE_STR_LEN];
 	bt_addr_le_to_str(bt_conn_get_dst(conn), dev, sizeof(dev));
 
@@ -206,25 +220,22 @@ static uint8_t handleReadResult(bt_conn *conn, uint8_t err, bt_gatt_read_params
 	BleCentral *ble_inst = BleCentral::getInstance();
 
 	if (!data) {
-		LOG_HEXDUMP_DBG(ble_inst->_ble_buf, ble_inst->_ble_buf_ctr, "BLE read");
-
-		cs_packet_data ble_read_data;
-		memset(&ble_read_data, 0, sizeof(ble_read_data));
-		ble_read_data.msg.buf_len = ble_inst->_ble_buf_ctr;
-		ble_read_data.src_id = ble_inst->_src_id;
-		ble_read_data.dest_id = ble_inst->_dest_id;
-		ble_read_data.type = CS_DATA_OUTGOING;
-		ble_read_data.result_code = CS_RESULT_TYPE_SUCCES;
-		memcpy(&ble_read_data.msg.buf, ble_inst->_ble_buf, ble_inst->_ble_buf_ctr);
-
-		if (ble_inst->_pkt_handler != NULL) {
-			// data is copied into work handler, so we don't have to save the struct
-			ble_inst->_pkt_handler->handlePacket(&ble_read_data);
-		} else {
-			LOG_WRN("%s", "Failed to handle BLE message");
+		cs_packet_buf *buf = ble_inst->_rx_buf;
+		ble_inst->_rx_buf = NULL;
+		if (buf == NULL) {
+			return BT_GATT_ITER_STOP;
 		}
 
-		ble_inst->_ble_buf_ctr = 0;
+		LOG_HEXDUMP_DBG(buf->data, buf->len, "BLE read");
+
+		buf->src_id = ble_inst->_src_id;
+		buf->dest_id = ble_inst->_dest_id;
+		buf->type = CS_DATA_OUTGOING;
+		buf->result_code = CS_RESULT_TYPE_SUCCES;
+
+		// the reference to the buffer is moved to the handler
+		ble_inst->_pkt_handler->handlePacket(buf);
+
 		LOG_DBG("%s", "Read completed.");
 		return BT_GATT_ITER_STOP;
 	}
@@ -238,17 +249,21 @@ static uint8_t handleReadResult(bt_conn *conn, uint8_t err, bt_gatt_read_params
 		return BT_GATT_ITER_STOP;
 	}
 
-	uint16_t offset = 0;
-	if (params->single.offset > 0) {
-		offset = params->single.offset;
+	if (ble_inst->_rx_buf == NULL && ble_inst->_pkt_handler != NULL) {
+		ble_inst->_rx_buf = ble_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
 	}
-	if ((offset + length) > sizeof(ble_inst->_ble_buf)) {
-		LOG_ERR("%s", "Read failed, message length exceeds buffer size");
+	if (ble_inst->_rx_buf == NULL) {
+		LOG_ERR("%s", "Read failed, no buffer available");
 		return BT_GATT_ITER_STOP;
 	}
+
 	// add data to buffer, in case the read data exceeds our MTU read is done in chunks
-	memcpy(ble_inst->_ble_buf + offset, (uint8_t *)data, length);
-	ble_inst->_ble_buf_ctr += length;
+	uint8_t *chunk = PacketBufferPool::add(ble_inst->_rx_buf, length);
+	if (chunk == NULL) {
+		LOG_ERR("%s", "Read failed, message length exceeds buffer size");
+		return BT_GATT_ITER_STOP;
+	}
+	memcpy(chunk, (uint8_t *)data, length);
 
 	return BT_GATT_ITER_CONTINUE;
 }
@@ -432,6 +447,15 @@ cs_ret_code_t BleCentral::init(const char *base_uuid, PacketHandler *pkt_handler
 	// indicate that we are ready for a connection
 	k_event_post(&_ble_conn_evts, CS_BLE_CENTRAL_AVAILABLE_EVENT);
 
+	// start dedicated work queue for sending packets, given to the PacketHandler
+	k_work_queue_config workq_cfg = {0};
+	workq_cfg.name = "cs_ble_workq";
+
+	k_work_queue_init(&_ble_workq);
+	k_work_queue_start(&_ble_workq, ble_workq_stack_area,
+			   K_THREAD_STACK_SIZEOF(ble_workq_stack_area), CS_BLE_CENTRAL_WORKQ_PRIORITY,
+			   &workq_cfg);
+
 	_pkt_handler = pkt_handler;
 	_initialized = true;
 
@@ -523,6 +547,7 @@ cs_ret_code_t BleCentral::discoverServices(ServiceUuid *uuid)
 
 /**
  * @brief Write a GATT message.
+ * The data is not copied, so it should remain valid until the write has completed.
  *
  * @param handle Attribute handle.
  * @param data Data buffer to write.
@@ -548,10 +573,8 @@ cs_ret_code_t BleCentral::write(uint16_t handle, uint8_t *data, uint16_t len)
 		return CS_ERR_BLE_CENTRAL_INCORRECT_MTU;
 	}
 
-	memcpy(_ble_buf, data, len);
-
 	memset(&_gatt_write_params, 0, sizeof(_gatt_write_params));
-	_gatt_write_params.data = _ble_buf;
+	_gatt_write_params.data = data;
 	_gatt_write_params.func = handleWriteResult;
 	_gatt_write_params.handle = handle;
 	_gatt_write_params.length = len;
@@ -586,7 +609,8 @@ cs_ret_code_t BleCentral::read(uint16_t handle)
 	}
 
 	// used to do chunked reads in handler
-	_ble_buf_ctr = 0;
+	PacketBufferPool::unref(_rx_buf);
+	_rx_buf = NULL;
 
 	memset(&_gatt_read_params, 0, sizeof(_gatt_read_params));
 	_gatt_read_params.func = handleReadResult;
@@ -608,27 +632,48 @@ cs_ret_code_t BleCentral::read(uint16_t handle)
  * The device will respond with session data directly after the connection.
  * Callback function for PacketHandler.
  *
- * @param inst Pointer to BleCentral class instance.
- * @param message Pointer to buffer with the message.
- * @param len Length of the message.
+ * @param work Pointer to the work item of the packet handler.
  */
 void BleCentral::sendBleMessage(k_work *work)
 {
 	cs_packet_handler *hdlr = CONTAINER_OF(work, cs_packet_handler, work_item);
 	BleCentral *ble_inst = BleCentral::getInstance();
-	k_spinlock_key_t key;
 
-	key = k_spin_lock(&hdlr->work_lock);
+	// a write is still ongoing, the queue is continued once it completes
+	if (ble_inst->_tx_buf != NULL) {
+		return;
+	}
+
+	cs_packet_buf *buf = PacketHandler::takePacket(hdlr);
+	if (buf == NULL) {
+		return;
+	}
 
 	if (!ble_inst->isConnected()) {
-		ble_inst->connect((char *)hdlr->msg.buf);
-		k_spin_unlock(&hdlr->work_lock, key);
+		// the payload contains the address of the device to connect to
+		char addr_str[BT_ADDR_LE_STR_LEN];
+		uint16_t addr_len = MIN(buf->len, sizeof(addr_str) - 1);
+		memcpy(addr_str, buf->data, addr_len);
+		addr_str[addr_len] = '\0';
+		PacketBufferPool::unref(buf);
+
+		ble_inst->connect(addr_str);
 		return;
-	} else {
-		if (ble_inst->_controlHandle != 0) {
-			ble_inst->write(ble_inst->_controlHandle, hdlr->msg.buf, hdlr->msg.buf_len);
-			k_spin_unlock(&hdlr->work_lock, key);
-		}
+	}
+
+	if (ble_inst->_controlHandle == 0) {
+		PacketBufferPool::unref(buf);
+		PacketHandler::scheduleNext(hdlr);
+		return;
+	}
+
+	// keep the buffer referenced until the write has completed
+	ble_inst->_tx_hdlr = hdlr;
+	ble_inst->_tx_buf = buf;
+	if (ble_inst->write(ble_inst->_controlHandle, buf->data, buf->len) != CS_OK) {
+		ble_inst->_tx_buf = NULL;
+		PacketBufferPool::unref(buf);
+		PacketHandler::scheduleNext(hdlr);
 	}
 }
 
@@ -0,0 +1,479 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#include "drivers/cs_ModbusMaster.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(cs_ModbusMaster, LOG_LEVEL_INF);
+
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+K_THREAD_STACK_DEFINE(modbus_tid_stack_area, CS_MODBUS_THREAD_STACK_SIZE);
+
+/**
+ * @brief Merge a block into another block of the schedule, if both are read the same way and
+ * the registers overlap or are adjacent. Blocks with a gap in between are not merged, as the
+ * registers in the gap may not exist.
+ *
+ * @param dst Block that is extended.
+ * @param src Block that is merged into dst.
+ *
+ * @return True if the block was merged.
+ */
+static bool mergePoll(cs_modbus_poll *dst, const cs_modbus_poll *src)
+{
+	if (dst->slave_id != src->slave_id || dst->function != src->function ||
+	    dst->interval_ms != src->interval_ms) {
+		return false;
+	}
+
+	uint32_t dst_end = dst->start + dst->count;
+	uint32_t src_end = src->start + src->count;
+	if (src->start > dst_end || dst->start > src_end) {
+		return false;
+	}
+
+	uint32_t start = MIN(dst->start, src->start);
+	uint32_t end = MAX(dst_end, src_end);
+	if (end - start > CS_MODBUS_MAX_REGISTERS) {
+		return false;
+	}
+
+	dst->start = start;
+	dst->count = end - start;
+	dst->next_poll = MIN(dst->next_poll, src->next_poll);
+
+	return true;
+}
+
+/**
+ * @brief Take the block that should be read next from the schedule, if it is due.
+ * The block is rescheduled, a block that fell behind is not read multiple times to catch up.
+ *
+ * @param mb_inst Pointer to the class instance.
+ * @param poll Copy of the block that is due.
+ * @param wait_ms Time till the next block is due, if none is due now.
+ *
+ * @return True if a block is due.
+ */
+static bool takeDuePoll(ModbusMaster *mb_inst, cs_modbus_poll *poll, int64_t *wait_ms)
+{
+	cs_modbus_poll *next = NULL;
+	bool due = false;
+
+	k_mutex_lock(&mb_inst->_poll_mtx, K_FOREVER);
+
+	for (int i = 0; i < mb_inst->_poll_count; i++) {
+		if (next == NULL || mb_inst->_polls[i].next_poll < next->next_poll) {
+			next = &mb_inst->_polls[i];
+		}
+	}
+
+	int64_t now = k_uptime_get();
+	if (next == NULL) {
+		*wait_ms = CS_MODBUS_IDLE_INTERVAL_MS;
+	} else if (next->next_poll > now) {
+		*wait_ms = next->next_poll - now;
+	} else {
+		*poll = *next;
+		next->next_poll += next->interval_ms;
+		if (next->next_poll <= now) {
+			next->next_poll = now + next->interval_ms;
+		}
+		due = true;
+	}
+
+	k_mutex_unlock(&mb_inst->_poll_mtx);
+
+	return due;
+}
+
+/**
+ * @brief Check whether a received frame comes from the slave of a block, for the function of the
+ * block. Other frames are part of another exchange on the bus.
+ */
+static bool matchesPoll(cs_modbus_poll *poll, cs_packet_buf *buf)
+{
+	return buf->len >= 2 && buf->data[0] == poll->slave_id &&
+	       (buf->data[1] & ~CS_MODBUS_FUNCTION_EXCEPTION) == poll->function;
+}
+
+/**
+ * @brief Check whether a received frame is the response to the request of a block.
+ *
+ * @param poll Block that was requested.
+ * @param buf Received frame.
+ *
+ * @return CS_MODBUS_STATUS_OK if the frame holds the registers of the block, the exception code
+ * if the slave rejected the request, else CS_MODBUS_STATUS_INVALID_RESPONSE.
+ */
+static cs_modbus_status checkResponse(cs_modbus_poll *poll, cs_packet_buf *buf)
+{
+	uint8_t *rsp = buf->data;
+
+	// the CRC over the frame including its own CRC is zero if the frame is intact
+	if (buf->len < CS_MODBUS_EXCEPTION_SIZE ||
+	    crc16_reflect(CS_MODBUS_CRC_POLY, CS_MODBUS_CRC_SEED, rsp, buf->len) != 0) {
+		LOG_WRN("%s", "Corrupted Modbus response");
+		return CS_MODBUS_STATUS_INVALID_RESPONSE;
+	}
+
+	if (rsp[0] != poll->slave_id) {
+		return CS_MODBUS_STATUS_INVALID_RESPONSE;
+	}
+
+	if (rsp[1] == (poll->function | CS_MODBUS_FUNCTION_EXCEPTION) &&
+	    buf->len == CS_MODBUS_EXCEPTION_SIZE) {
+		uint8_t code = rsp[2];
+		if (code == CS_MODBUS_STATUS_OK || code >= CS_MODBUS_FUNCTION_EXCEPTION) {
+			return CS_MODBUS_STATUS_INVALID_RESPONSE;
+		}
+		LOG_WRN("Slave %d returned exception %d", poll->slave_id, code);
+		return (cs_modbus_status)code;
+	}
+
+	uint16_t data_len = poll->count * 2;
+	if (rsp[1] != poll->function || rsp[2] != data_len ||
+	    buf->len != CS_MODBUS_RESPONSE_HDR_SIZE + data_len + CS_MODBUS_CRC_SIZE) {
+		return CS_MODBUS_STATUS_INVALID_RESPONSE;
+	}
+
+	return CS_MODBUS_STATUS_OK;
+}
+
+/**
+ * @brief Send the read request of a block and wait for its response. The response timeout starts
+ * once the request was transmitted, and covers the transfer of the response at the current
+ * baudrate, the silence that ends it and the turnaround time of the slave.
+ * Frames that don't answer the request are routed on, and the response is waited for still.
+ *
+ * @param mb_inst Pointer to the class instance.
+ * @param poll Block to read.
+ * @param resp Set to the response if the registers were read, the caller owns the reference.
+ *
+ * @return Status of the request, see @ref checkResponse. CS_MODBUS_STATUS_TIMEOUT if no
+ * response was received in time.
+ */
+static cs_modbus_status requestPoll(ModbusMaster *mb_inst, cs_modbus_poll *poll,
+				    cs_packet_buf **resp)
+{
+	cs_packet_buf *buf;
+
+	// drop frames that arrived after an earlier request timed out
+	while (k_msgq_get(&mb_inst->_resp_msgq, &buf, K_NO_WAIT) == 0) {
+		PacketBufferPool::unref(buf);
+	}
+
+	buf = mb_inst->_pkt_handler->allocBuffer(K_MSEC(CS_MODBUS_TURNAROUND_MS));
+	if (buf == NULL) {
+		LOG_WRN("%s", "No buffer available for Modbus request");
+		return CS_MODBUS_STATUS_TIMEOUT;
+	}
+
+	uint8_t *req = PacketBufferPool::add(buf, CS_MODBUS_REQUEST_SIZE);
+	req[0] = poll->slave_id;
+	req[1] = poll->function;
+	sys_put_be16(poll->start, req + 2);
+	sys_put_be16(poll->count, req + 4);
+	// the CRC is the only field sent least significant byte first
+	uint16_t crc = crc16_reflect(CS_MODBUS_CRC_POLY, CS_MODBUS_CRC_SEED, req,
+				     CS_MODBUS_REQUEST_SIZE - CS_MODBUS_CRC_SIZE);
+	sys_put_le16(crc, req + CS_MODBUS_REQUEST_SIZE - CS_MODBUS_CRC_SIZE);
+
+	atomic_set(&mb_inst->_rsp_pending, 1);
+	k_sem_reset(&mb_inst->_tx_done_sem);
+
+	// the frame is sent as is, bypassing the packet handler so it isn't wrapped. Only this
+	// frame signals its transmission, not other traffic on the UART
+	buf->tx_done = &mb_inst->_tx_done_sem;
+	buf->enqueue_cyc = k_cycle_get_32();
+	if (PacketHandler::putPacket(mb_inst->_uart_hdlr, buf) != CS_OK) {
+		atomic_set(&mb_inst->_rsp_pending, 0);
+		return CS_MODBUS_STATUS_TIMEOUT;
+	}
+
+	// the slave only starts answering once the request left the transmitter
+	if (k_sem_take(&mb_inst->_tx_done_sem, K_MSEC(CS_UART_DRAIN_TIMEOUT_MS)) != 0) {
+		atomic_set(&mb_inst->_rsp_pending, 0);
+		LOG_WRN("Modbus request to slave %d was not transmitted", poll->slave_id);
+		return CS_MODBUS_STATUS_TIMEOUT;
+	}
+
+	// transfer of the full response and the silence that ends it, after the turnaround
+	uint32_t rsp_len = CS_MODBUS_RESPONSE_HDR_SIZE + poll->count * 2 + CS_MODBUS_CRC_SIZE;
+	uint32_t timeout_us = rsp_len * mb_inst->_uart->getCharTimeUs();
+	timeout_us += mb_inst->_uart->_rx_timeout_us + CS_MODBUS_TURNAROUND_MS * USEC_PER_MSEC;
+	int64_t deadline = k_uptime_get() + DIV_ROUND_UP(timeout_us, USEC_PER_MSEC);
+
+	cs_modbus_status status = CS_MODBUS_STATUS_TIMEOUT;
+	while (1) {
+		int64_t remaining = deadline - k_uptime_get();
+		if (remaining <= 0 ||
+		    k_msgq_get(&mb_inst->_resp_msgq, &buf, K_MSEC(remaining)) != 0) {
+			LOG_WRN("Modbus request to slave %d timed out", poll->slave_id);
+			break;
+		}
+
+		if (!matchesPoll(poll, buf)) {
+			mb_inst->_uart->routeFrame(buf);
+			continue;
+		}
+
+		status = checkResponse(poll, buf);
+		if (status == CS_MODBUS_STATUS_OK) {
+			*resp = buf;
+		} else {
+			PacketBufferPool::unref(buf);
+		}
+		break;
+	}
+
+	atomic_set(&mb_inst->_rsp_pending, 0);
+
+	return status;
+}
+
+/**
+ * @brief Send the result of reading a block as data packet, from the UART to its destination.
+ *
+ * @param mb_inst Pointer to the class instance.
+ * @param poll Block that was read.
+ * @param status Status of the read.
+ * @param resp Response holding the registers, used if the status is CS_MODBUS_STATUS_OK.
+ */
+static void sendPollResult(ModbusMaster *mb_inst, cs_modbus_poll *poll, cs_modbus_status status,
+			   cs_packet_buf *resp)
+{
+	cs_packet_buf *buf = mb_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
+	if (buf == NULL) {
+		LOG_WRN("%s", "No buffer available for Modbus result, dropping");
+		return;
+	}
+
+	uint8_t *hdr = PacketBufferPool::add(buf, CS_MODBUS_RESULT_HDR_SIZE);
+	hdr[0] = poll->slave_id;
+	hdr[1] = poll->function;
+	sys_put_le16(poll->start, hdr + 2);
+	hdr[4] = poll->count;
+	hdr[5] = status;
+
+	if (status == CS_MODBUS_STATUS_OK) {
+		// registers are big endian on the bus, the protocol is little endian
+		uint8_t *regs = PacketBufferPool::add(buf, poll->count * 2);
+		uint8_t *rsp_regs = resp->data + CS_MODBUS_RESPONSE_HDR_SIZE;
+		for (int i = 0; i < poll->count; i++) {
+			sys_put_le16(sys_get_be16(rsp_regs + i * 2), regs + i * 2);
+		}
+	}
+
+	buf->type = CS_DATA_OUTGOING;
+	buf->src_id = mb_inst->_uart->_src_id;
+	buf->dest_id = mb_inst->_uart->_dest_id;
+	// the result of a poll never answers a command that was sent to the bus
+	buf->unsolicited = true;
+
+	mb_inst->_pkt_handler->handlePacket(buf);
+}
+
+/**
+ * @brief Read the blocks of the schedule when they are due, one request at a time as only one
+ * request can be outstanding on the bus.
+ */
+static void handleModbusPolls(void *inst, void *unused1, void *unused2)
+{
+	ModbusMaster *mb_inst = static_cast<ModbusMaster *>(inst);
+	cs_modbus_poll poll;
+	int64_t wait_ms;
+
+	while (1) {
+		if (!takeDuePoll(mb_inst, &poll, &wait_ms)) {
+			// woken early when a block is added
+			k_sem_take(&mb_inst->_poll_sem, K_MSEC(wait_ms));
+			continue;
+		}
+
+		cs_packet_buf *resp = NULL;
+		cs_modbus_status status = CS_MODBUS_STATUS_TIMEOUT;
+		for (int i = 0; i <= CS_MODBUS_RETRIES; i++) {
+			// a retry is separated from the failed exchange by at least a frame gap
+			if (i > 0) {
+				uint32_t gap_us = mb_inst->_uart->getCharTimeUs() *
+						  CS_UART_FRAME_GAP_TENTHS;
+				k_sleep(K_USEC(DIV_ROUND_UP(gap_us, 10)));
+			}
+			status = requestPoll(mb_inst, &poll, &resp);
+			// an exception is a valid answer, asking again gives the same result
+			if (status != CS_MODBUS_STATUS_TIMEOUT &&
+			    status != CS_MODBUS_STATUS_INVALID_RESPONSE) {
+				break;
+			}
+		}
+
+		sendPollResult(mb_inst, &poll, status, resp);
+		PacketBufferPool::unref(resp);
+	}
+}
+
+/**
+ * @brief Initialize the Modbus master. The UART should be initialized and its handler
+ * registered, its received frames pass the master first.
+ *
+ * @param uart UART the slaves are connected to, preferably using idle framing.
+ * @param handler PacketHandler instance.
+ *
+ * @return CS_OK if the master is initialized successfully.
+ */
+cs_ret_code_t ModbusMaster::init(Uart *uart, PacketHandler *handler)
+{
+	if (_initialized) {
+		LOG_ERR("%s", "Already initialized");
+		return CS_ERR_ALREADY_INITIALIZED;
+	}
+
+	if (uart == NULL || handler == NULL) {
+		return CS_ERR_INVALID_PARAM;
+	}
+
+	_uart_hdlr = handler->getHandler(uart->_src_id);
+	if (_uart_hdlr == NULL) {
+		LOG_ERR("No handler registered for UART %d", uart->_src_id);
+		return CS_ERR_PACKET_HANDLER_NOT_FOUND;
+	}
+
+	if (uart->_framing != CS_UART_FRAMING_IDLE) {
+		LOG_WRN("%s", "UART doesn't use idle framing, Modbus responses may be split");
+	}
+
+	_uart = uart;
+	_pkt_handler = handler;
+
+	k_mutex_init(&_poll_mtx);
+	k_sem_init(&_poll_sem, 0, 1);
+	k_sem_init(&_tx_done_sem, 0, 1);
+	k_msgq_init(&_resp_msgq, _resp_msgq_buf, sizeof(cs_packet_buf *),
+		    CS_MODBUS_RESPONSE_QUEUE_SIZE);
+
+	_uart->setRxCallback(handleResponse, this);
+
+	k_thread_create(&_modbus_tid, modbus_tid_stack_area,
+			K_THREAD_STACK_SIZEOF(modbus_tid_stack_area), handleModbusPolls, this, NULL,
+			NULL, CS_MODBUS_THREAD_PRIORITY, 0, K_NO_WAIT);
+
+	_initialized = true;
+
+	return CS_OK;
+}
+
+/**
+ * @brief Add a block of registers to the poll schedule. The block is merged with blocks of the
+ * same slave, function and interval if the registers overlap or are adjacent, so they are read
+ * with a single request. The first read is done right away.
+ *
+ * @param slave_id Address of the slave.
+ * @param function Function code used to read the block.
+ * @param start Address of the first register.
+ * @param count Amount of registers, at most @ref CS_MODBUS_MAX_REGISTERS.
+ * @param interval_ms Time between two reads of the block.
+ *
+ * @return CS_OK if the block was added.
+ */
+cs_ret_code_t ModbusMaster::addPoll(uint8_t slave_id, cs_modbus_function function, uint16_t start,
+				    uint16_t count, uint32_t interval_ms)
+{
+	if (!_initialized) {
+		LOG_ERR("%s", "Not initialized");
+		return CS_ERR_NOT_INITIALIZED;
+	}
+
+	if (count == 0 || count > CS_MODBUS_MAX_REGISTERS || start + count > UINT16_MAX + 1 ||
+	    interval_ms == 0) {
+		LOG_ERR("%s", "Invalid Modbus poll");
+		return CS_ERR_INVALID_PARAM;
+	}
+
+	cs_modbus_poll poll = {slave_id, function, start, count, interval_ms, k_uptime_get()};
+
+	k_mutex_lock(&_poll_mtx, K_FOREVER);
+
+	int idx = -1;
+	for (int i = 0; i < _poll_count; i++) {
+		if (mergePoll(&_polls[i], &poll)) {
+			idx = i;
+			break;
+		}
+	}
+
+	if (idx < 0) {
+		if (_poll_count == CS_MODBUS_MAX_POLLS) {
+			k_mutex_unlock(&_poll_mtx);
+			LOG_ERR("%s", "Modbus poll schedule is full");
+			return CS_ERR_MODBUS_POLL_TABLE_FULL;
+		}
+		_polls[_poll_count++] = poll;
+	} else {
+		// the grown block may now bridge other blocks, keep merging till nothing changes
+		bool merged = true;
+		while (merged) {
+			merged = false;
+			for (int i = 0; i < _poll_count; i++) {
+				if (i == idx || !mergePoll(&_polls[idx], &_polls[i])) {
+					continue;
+				}
+				// remove the merged block by moving the last one in its place
+				_poll_count--;
+				_polls[i] = _polls[_poll_count];
+				if (idx == _poll_count) {
+					idx = i;
+				}
+				merged = true;
+				break;
+			}
+		}
+	}
+
+	k_mutex_unlock(&_poll_mtx);
+
+	k_sem_give(&_poll_sem);
+
+	return CS_OK;
+}
+
+/**
+ * @brief Receive callback of the UART, passes a received frame to the Modbus thread while it
+ * waits for a response. Other frames are not meant for the master, and are routed on.
+ *
+ * @param buf Received frame, the reference is moved to the master.
+ * @param inst Pointer to the class instance.
+ */
+void ModbusMaster::handleResponse(cs_packet_buf *buf, void *inst)
+{
+	ModbusMaster *mb_inst = static_cast<ModbusMaster *>(inst);
+
+	if (!atomic_get(&mb_inst->_rsp_pending) ||
+	    k_msgq_put(&mb_inst->_resp_msgq, &buf, K_NO_WAIT) != 0) {
+		mb_inst->_uart->routeFrame(buf);
+	}
+}
+
+/**
+ * @brief Stop polling and release the UART.
+ */
+ModbusMaster::~ModbusMaster()
+{
+	if (!_initialized) {
+		return;
+	}
+
+	k_thread_abort(&_modbus_tid);
+	_uart->setRxCallback(NULL, NULL);
+
+	cs_packet_buf *buf;
+	while (k_msgq_get(&_resp_msgq, &buf, K_NO_WAIT) == 0) {
+		PacketBufferPool::unref(buf);
+	}
+}
\ No newline at end of file
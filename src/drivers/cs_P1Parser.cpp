@@ -0,0 +1,342 @@
+/**
+ * Author: Ricardo Steijn
+ * Copyright: Crownstone (https://crownstone.rocks)
+ * Date: 16 Oct., 2026
+ * License: Apache License 2.0
+ */
+
+#include "drivers/cs_P1Parser.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(cs_P1Parser, LOG_LEVEL_INF);
+
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+
+#include <ctype.h>
+#include <string.h>
+
+/**
+ * @brief Parse the OBIS reference at the start of a line, formatted as a-b:c.d.e and followed by
+ * the values between parentheses.
+ *
+ * @param line Line of the telegram, without line ending.
+ * @param len Length of the line.
+ * @param obis Parsed OBIS reference.
+ *
+ * @return Position of the first value in the line, or -1 if the line holds no OBIS reference.
+ */
+static int parseObis(const char *line, int len, cs_p1_obis *obis)
+{
+	static const char separators[CS_P1_OBIS_SIZE] = {'-', ':', '.', '.', '('};
+	int pos = 0;
+
+	for (int i = 0; i < CS_P1_OBIS_SIZE; i++) {
+		uint32_t field = 0;
+		int digits = 0;
+		while (pos < len && isdigit((int)line[pos]) && field <= UINT8_MAX) {
+			field = field * 10 + (line[pos++] - '0');
+			digits++;
+		}
+		if (digits == 0 || field > UINT8_MAX || pos == len || line[pos] != separators[i]) {
+			return -1;
+		}
+		obis->code[i] = field;
+		pos++;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief Parse a numeric value, e.g. 001234.567*kWh, into a fixed point number with
+ * @ref CS_P1_VALUE_DECIMALS decimals. The unit is ignored, further decimals are truncated.
+ *
+ * @param val Start of the value, after the opening parenthesis.
+ * @param len Amount of characters up to the end of the line.
+ * @param value Parsed value.
+ *
+ * @return True if the value is numeric and in range.
+ */
+static bool parseValue(const char *val, int len, int32_t *value)
+{
+	int64_t result = 0;
+	int digits = 0;
+	int decimals = -1;
+	int pos = 0;
+
+	for (; pos < len && val[pos] != ')' && val[pos] != '*'; pos++) {
+		if (val[pos] == '.' && decimals < 0) {
+			decimals = 0;
+		} else if (!isdigit((int)val[pos])) {
+			return false;
+		} else if (decimals < CS_P1_VALUE_DECIMALS) {
+			result = result * 10 + (val[pos] - '0');
+			digits++;
+			if (decimals >= 0) {
+				decimals++;
+			}
+			// e.g. timestamps don't fit, and aren't numeric values
+			if (result > INT32_MAX) {
+				return false;
+			}
+		}
+	}
+
+	if (digits == 0 || pos == len) {
+		return false;
+	}
+
+	for (decimals = MAX(decimals, 0); decimals < CS_P1_VALUE_DECIMALS; decimals++) {
+		result *= 10;
+	}
+	if (result > INT32_MAX) {
+		return false;
+	}
+
+	*value = result;
+	return true;
+}
+
+/**
+ * @brief Extract the value of a line if its OBIS reference is configured. When a line holds
+ * multiple values, e.g. the timestamp and reading of a gas meter, the last one is used.
+ */
+static void parseLine(P1Parser *p1_inst)
+{
+	const char *line = p1_inst->_line;
+	int len = p1_inst->_line_len;
+	cs_p1_obis obis;
+
+	if (p1_inst->_line_overflow) {
+		return;
+	}
+
+	int pos = parseObis(line, len, &obis);
+	if (pos < 0) {
+		return;
+	}
+
+	for (int i = 0; i < p1_inst->_obis_count; i++) {
+		if (memcmp(obis.code, p1_inst->_obis[i].code, CS_P1_OBIS_SIZE) != 0) {
+			continue;
+		}
+
+		for (int j = len - 1; j >= pos; j--) {
+			if (line[j] == '(') {
+				pos = j + 1;
+				break;
+			}
+		}
+		if (parseValue(line + pos, len - pos, &p1_inst->_values[i])) {
+			p1_inst->_present |= BIT(i);
+		}
+		return;
+	}
+}
+
+/**
+ * @brief Send the values extracted from a telegram as data packet, from the UART to its
+ * destination.
+ */
+static void sendTelegram(P1Parser *p1_inst)
+{
+	cs_packet_buf *buf = p1_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
+	if (buf == NULL) {
+		LOG_WRN("%s", "No buffer available for P1 telegram, dropping");
+		return;
+	}
+
+	uint8_t *count = PacketBufferPool::add(buf, 1);
+	*count = 0;
+
+	for (int i = 0; i < p1_inst->_obis_count; i++) {
+		if (!(p1_inst->_present & BIT(i))) {
+			continue;
+		}
+		uint8_t *entry = PacketBufferPool::add(buf, CS_P1_ENTRY_SIZE);
+		memcpy(entry, p1_inst->_obis[i].code, CS_P1_OBIS_SIZE);
+		sys_put_le32(p1_inst->_values[i], entry + CS_P1_OBIS_SIZE);
+		(*count)++;
+	}
+
+	buf->type = CS_DATA_OUTGOING;
+	buf->src_id = p1_inst->_uart->_src_id;
+	buf->dest_id = p1_inst->_uart->_dest_id;
+	// a telegram never answers a command that was sent to the UART
+	buf->unsolicited = true;
+
+	p1_inst->_pkt_handler->handlePacket(buf);
+}
+
+/**
+ * @brief Start parsing a new telegram, a telegram that was being received is dropped.
+ */
+static void startTelegram(P1Parser *p1_inst, uint8_t c)
+{
+	p1_inst->_crc = crc16_reflect(CS_P1_CRC_POLY, CS_P1_CRC_SEED, &c, 1);
+	p1_inst->_line_len = 0;
+	p1_inst->_line_overflow = false;
+	p1_inst->_present = 0;
+	p1_inst->_state = CS_P1_STATE_DATA;
+}
+
+/**
+ * @brief Handle the end of the CRC line. Telegrams of DSMR versions before 4.0 don't carry a
+ * CRC, and are accepted as is.
+ */
+static void finishTelegram(P1Parser *p1_inst)
+{
+	p1_inst->_state = CS_P1_STATE_WAIT_START;
+
+	if (p1_inst->_crc_digits != 0 &&
+	    (p1_inst->_crc_digits != CS_P1_CRC_DIGITS || p1_inst->_rx_crc != p1_inst->_crc)) {
+		LOG_WRN("%s", "P1 telegram CRC mismatch, dropping");
+		return;
+	}
+
+	sendTelegram(p1_inst);
+}
+
+/**
+ * @brief Parse received bytes. Telegrams may be split over any amount of calls.
+ *
+ * @param data Received bytes.
+ * @param len Amount of bytes.
+ */
+void P1Parser::parse(const uint8_t *data, uint16_t len)
+{
+	for (uint16_t i = 0; i < len; i++) {
+		uint8_t c = data[i];
+		uint8_t nibble;
+
+		switch (_state) {
+		case CS_P1_STATE_WAIT_START:
+			if (c == CS_P1_START_TOKEN) {
+				startTelegram(this, c);
+			}
+			break;
+		case CS_P1_STATE_DATA:
+			// the end of the previous telegram was lost
+			if (c == CS_P1_START_TOKEN) {
+				startTelegram(this, c);
+				break;
+			}
+			_crc = crc16_reflect(CS_P1_CRC_POLY, _crc, &c, 1);
+			if (c == CS_P1_END_TOKEN) {
+				_rx_crc = 0;
+				_crc_digits = 0;
+				_state = CS_P1_STATE_CRC;
+			} else if (c == '\n') {
+				parseLine(this);
+				_line_len = 0;
+				_line_overflow = false;
+			} else if (c != '\r') {
+				if (_line_len < CS_P1_LINE_SIZE) {
+					_line[_line_len++] = c;
+				} else {
+					_line_overflow = true;
+				}
+			}
+			break;
+		case CS_P1_STATE_CRC:
+			if (c == '\r' || c == '\n') {
+				finishTelegram(this);
+			} else if (_crc_digits < CS_P1_CRC_DIGITS && char2hex(c, &nibble) == 0) {
+				_rx_crc = (_rx_crc << 4) | nibble;
+				_crc_digits++;
+			} else {
+				LOG_WRN("%s", "Invalid P1 telegram CRC, dropping");
+				_state = CS_P1_STATE_WAIT_START;
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Initialize the parser. The UART should be initialized, its received data is taken over
+ * by the parser. Idle framing is preferred, so the data is passed on as soon as the meter is done
+ * sending a telegram.
+ *
+ * @param uart UART the smart meter is connected to.
+ * @param handler PacketHandler instance.
+ *
+ * @return CS_OK if the parser is initialized successfully.
+ */
+cs_ret_code_t P1Parser::init(Uart *uart, PacketHandler *handler)
+{
+	if (_initialized) {
+		LOG_ERR("%s", "Already initialized");
+		return CS_ERR_ALREADY_INITIALIZED;
+	}
+
+	if (uart == NULL || handler == NULL) {
+		return CS_ERR_INVALID_PARAM;
+	}
+
+	// line framing strips the line endings, which are part of the CRC
+	if (uart->_framing == CS_UART_FRAMING_LINE) {
+		LOG_ERR("%s", "P1 telegrams can't be parsed with line framing");
+		return CS_ERR_UART_CONFIG_INVALID;
+	}
+
+	_uart = uart;
+	_pkt_handler = handler;
+
+	_uart->setRxCallback(handleData, this);
+
+	_initialized = true;
+
+	return CS_OK;
+}
+
+/**
+ * @brief Add an OBIS reference of which the value is extracted from the telegrams.
+ * References are added before initialization, as the parser reads them without locking.
+ *
+ * @param obis OBIS reference, e.g. {1, 0, 1, 8, 1} for the delivered energy in tariff 1.
+ *
+ * @return CS_OK if the reference was added.
+ */
+cs_ret_code_t P1Parser::addObis(const cs_p1_obis *obis)
+{
+	if (_initialized) {
+		LOG_ERR("%s", "Already initialized");
+		return CS_ERR_ALREADY_INITIALIZED;
+	}
+
+	if (_obis_count == CS_P1_MAX_OBIS) {
+		LOG_ERR("%s", "P1 OBIS table is full");
+		return CS_ERR_P1_OBIS_TABLE_FULL;
+	}
+
+	_obis[_obis_count++] = *obis;
+
+	return CS_OK;
+}
+
+/**
+ * @brief Receive callback of the UART, parses the received data in the UART thread.
+ *
+ * @param buf Received data, the reference is moved to the parser.
+ * @param inst Pointer to the class instance.
+ */
+void P1Parser::handleData(cs_packet_buf *buf, void *inst)
+{
+	P1Parser *p1_inst = static_cast<P1Parser *>(inst);
+
+	p1_inst->parse(buf->data, buf->len);
+	PacketBufferPool::unref(buf);
+}
+
+/**
+ * @brief Release the UART.
+ */
+P1Parser::~P1Parser()
+{
+	if (_initialized) {
+		_uart->setRxCallback(NULL, NULL);
+	}
+}
\ No newline at end of file
@@ -6,16 +6,380 @@
  */
 
 #include "drivers/cs_Uart.h"
+#include "cs_Crc16.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(cs_Uart, LOG_LEVEL_INF);
 
+#include <zephyr/sys/byteorder.h>
+
 #include <string.h>
 
-K_THREAD_STACK_DEFINE(uart_tid_stack_area, CS_UART_THREAD_STACK_SIZE);
+#define DT_DRV_COMPAT crownstone_router_uart
+
+#define CS_UART_RX_RING(inst) DT_INST_PROP_OR(inst, rx_buffer_size, CS_UART_RX_RING_SIZE)
+#define CS_UART_TX_RING(inst) DT_INST_PROP_OR(inst, tx_buffer_size, CS_UART_TX_RING_SIZE)
+#define CS_UART_THREAD_STACK(inst)                                                                 \
+	DT_INST_PROP_OR(inst, thread_stack_size, CS_UART_THREAD_STACK_SIZE)
+#define CS_UART_WORKQ_STACK(inst) DT_INST_PROP_OR(inst, workq_stack_size, CS_UART_WORKQ_STACK_SIZE)
+#define CS_UART_MODBUS_POLLS_LEN(inst) DT_INST_PROP_LEN_OR(inst, modbus_polls, 0)
+
+/**
+ * @brief Define the memory and configuration of a UART instance from devicetree.
+ */
+#define CS_UART_DEFINE(inst)                                                                       \
+	K_THREAD_STACK_DEFINE(uart_tid_stack_area_##inst, CS_UART_THREAD_STACK(inst));             \
+	K_THREAD_STACK_DEFINE(uart_workq_stack_area_##inst, CS_UART_WORKQ_STACK(inst));            \
+	BUILD_ASSERT(IS_POWER_OF_TWO(CS_UART_RX_RING(inst)),                                       \
+		     "RX ring size should be a power of two");                                     \
+	static uint8_t uart_rx_ring_buf_##inst[CS_UART_RX_RING(inst)];                             \
+	static uint8_t uart_tx_ring_buf_##inst[CS_UART_TX_RING(inst)];                             \
+	BUILD_ASSERT(CS_UART_MODBUS_POLLS_LEN(inst) % CS_UART_MODBUS_POLL_CELLS == 0,              \
+		     "Modbus polls should have 5 cells each");                                     \
+	static const uint32_t uart_modbus_polls_##inst[] =                                         \
+		DT_INST_PROP_OR(inst, modbus_polls, {0});                                          \
+	static const cs_uart_instance_config uart_cfg_##inst = {                                   \
+		DEVICE_DT_GET(DT_INST_PHANDLE(inst, uart)),                                        \
+		(cs_router_instance_id)DT_INST_PROP(inst, instance_id),                            \
+		(cs_router_instance_id)DT_INST_PROP(inst, destination_id),                         \
+		(cs_uart_framing_mode)DT_INST_ENUM_IDX(inst, framing),                             \
+		DT_INST_PROP(inst, half_duplex),                                                   \
+		DT_INST_PROP_OR(inst, frame_gap_tenths, CS_UART_FRAME_GAP_TENTHS),                 \
+		DT_PROP_OR(DT_INST_PHANDLE(inst, uart), current_speed, CS_UART_RS_BAUD_DEFAULT),   \
+		DT_NODE_FULL_NAME(DT_DRV_INST(inst)),                                              \
+		GPIO_DT_SPEC_INST_GET_OR(inst, de_gpios, {0}),                                     \
+		DT_INST_PROP_OR(inst, de_pre_delay_us, 0),                                         \
+		DT_INST_PROP_OR(inst, de_post_delay_us, 0),                                        \
+		DT_INST_PROP_OR(inst, de_busy_wait_max_us, CS_UART_DE_BUSY_WAIT_MAX_US),           \
+		uart_modbus_polls_##inst,                                                          \
+		CS_UART_MODBUS_POLLS_LEN(inst),                                                    \
+		uart_rx_ring_buf_##inst,                                                           \
+		sizeof(uart_rx_ring_buf_##inst),                                                   \
+		uart_tx_ring_buf_##inst,                                                           \
+		sizeof(uart_tx_ring_buf_##inst),                                                   \
+		uart_tid_stack_area_##inst,                                                        \
+		K_THREAD_STACK_SIZEOF(uart_tid_stack_area_##inst),                                 \
+		uart_workq_stack_area_##inst,                                                      \
+		K_THREAD_STACK_SIZEOF(uart_workq_stack_area_##inst),                               \
+	};                                                                                         \
+	static Uart uart_inst_##inst(&uart_cfg_##inst);
+
+#define CS_UART_INSTANCE_PTR(inst) &uart_inst_##inst,
+
+DT_INST_FOREACH_STATUS_OKAY(CS_UART_DEFINE)
+
+static Uart *const uart_instances[] = {DT_INST_FOREACH_STATUS_OKAY(CS_UART_INSTANCE_PTR)};
+
+/**
+ * @brief Route a received frame through the packet handler.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param buf Received frame, the reference is moved.
+ */
+static void routeUartFrame(Uart *uart_inst, cs_packet_buf *buf)
+{
+	buf->dest_id = uart_inst->_dest_id;
+
+	// packets sent from CM4 start with a specific token, handle the packet as incoming.
+	// Only packet framing carries them, other framings can start with the same value
+	if (uart_inst->_framing == CS_UART_FRAMING_PACKET &&
+	    buf->data[0] == CS_PACKET_UART_START_TOKEN) {
+		buf->src_id = CS_INSTANCE_ID_UART_CM4;
+		buf->type = CS_DATA_INCOMING;
+	} else {
+		// packet is sent from this instance, use own source id
+		buf->src_id = uart_inst->_src_id;
+		buf->type = CS_DATA_OUTGOING;
+	}
+
+	// dispatch the buffer, the reference is moved to the handler
+	// handler not running due to error, stop receiving
+	if (uart_inst->_pkt_handler->handlePacket(buf) == CS_ERR_ABORTED) {
+		uart_inst->_rx_aborted = true;
+	}
+}
+
+/**
+ * @brief Pass a received frame on, to the protocol running on top of this UART or to the packet
+ * handler.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param buf Received frame, the reference is moved.
+ */
+static void dispatchUartFrame(Uart *uart_inst, cs_packet_buf *buf)
+{
+	LOG_HEXDUMP_DBG(buf->data, buf->len, "uart message");
+
+	// a protocol running on top of this UART consumes its frames itself
+	if (uart_inst->_rx_cb != NULL) {
+		uart_inst->_rx_cb(buf, uart_inst->_rx_cb_ctx);
+		return;
+	}
+
+	routeUartFrame(uart_inst, buf);
+}
 
 /**
- * @brief Thread function that handles messages in the UART message queue.
+ * @brief Pass the frame that is currently being received on.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param rx_cyc Cycle count at which the last byte of the frame was received.
+ */
+static void flushUartRxFrame(Uart *uart_inst, uint32_t rx_cyc)
+{
+	if (uart_inst->_rx_buf == NULL) {
+		return;
+	}
+
+	if (uart_inst->_rx_buf->len > 0) {
+		uart_inst->_rx_buf->rx_cyc = rx_cyc;
+		dispatchUartFrame(uart_inst, uart_inst->_rx_buf);
+		uart_inst->_rx_buf = NULL;
+	}
+}
+
+/**
+ * @brief Pass the line or packet that is currently being received on.
+ */
+static void flushUartRxBuffer(Uart *uart_inst)
+{
+	flushUartRxFrame(uart_inst, uart_inst->_rx_last_cyc);
+}
+
+/**
+ * @brief Drop the packet that is currently being received, and wait for the next start token.
+ */
+static void resetUartRxPacket(Uart *uart_inst)
+{
+	PacketBufferPool::unref(uart_inst->_rx_buf);
+	uart_inst->_rx_buf = NULL;
+	uart_inst->_rx_state = CS_UART_RX_STATE_SYNC;
+}
+
+/**
+ * @brief Assert the driver enable of the transceiver, and wait till it is ready to transmit.
+ * Called from the work queue without the TX lock held. A short delay is busy waited, as sleeping
+ * would round it up to a system tick.
+ */
+static void enableUartDriver(Uart *uart_inst)
+{
+	const gpio_dt_spec *de = &uart_inst->_cfg->de_gpio;
+	uint16_t delay_us = uart_inst->_cfg->de_pre_delay_us;
+
+	if (de->port == NULL) {
+		return;
+	}
+
+	gpio_pin_set_dt(de, 1);
+	if (delay_us <= uart_inst->_cfg->de_busy_wait_max_us) {
+		k_busy_wait(delay_us);
+	} else {
+		k_sleep(K_USEC(delay_us));
+	}
+}
+
+/**
+ * @brief Release the bus once the last byte left the shift register. The driver enable of the
+ * transceiver is released, and a half-duplex UART starts receiving again.
+ * Should be called with the TX lock held.
+ */
+static void releaseUartBusLocked(Uart *uart_inst)
+{
+	const gpio_dt_spec *de = &uart_inst->_cfg->de_gpio;
+
+	if (de->port != NULL) {
+		gpio_pin_set_dt(de, 0);
+	}
+
+	uart_inst->_tx_active = false;
+	uart_inst->_tx_releasing = false;
+	if (uart_inst->_half_duplex) {
+		uart_irq_rx_enable(uart_inst->_uart_dev);
+	}
+	if (uart_inst->_tx_done != NULL) {
+		k_sem_give(uart_inst->_tx_done);
+		uart_inst->_tx_done = NULL;
+	}
+}
+
+/**
+ * @brief Release the bus once the post-delay of the driver enable expired.
+ */
+static void handleUartDriverRelease(k_timer *timer)
+{
+	Uart *uart_inst = static_cast<Uart *>(k_timer_user_data_get(timer));
+
+	k_spinlock_key_t key = k_spin_lock(&uart_inst->_tx_lock);
+
+	// a new transmission started in the meantime, it keeps the bus
+	if (uart_inst->_tx_releasing) {
+		releaseUartBusLocked(uart_inst);
+	}
+
+	k_spin_unlock(&uart_inst->_tx_lock, key);
+}
+
+/**
+ * @brief Handle a received byte in line mode. Lines are ended by CR or LF.
+ */
+static void handleUartLineByte(Uart *uart_inst, uint8_t c)
+{
+	// store characters until line end is detected, or buffer if full
+	if (c == '\n' || c == '\r') {
+		flushUartRxBuffer(uart_inst);
+		return;
+	}
+
+	if (uart_inst->_rx_buf == NULL && uart_inst->_pkt_handler != NULL) {
+		uart_inst->_rx_buf = uart_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
+	}
+	// no buffer available, byte is dropped
+	if (uart_inst->_rx_buf == NULL) {
+		return;
+	}
+
+	*PacketBufferPool::add(uart_inst->_rx_buf, 1) = c;
+
+	if (PacketBufferPool::tailroom(uart_inst->_rx_buf) == 0) {
+		flushUartRxBuffer(uart_inst);
+	}
+}
+
+/**
+ * @brief Handle a received byte in packet mode. Synchronizes on the start token, then collects
+ * exactly the amount of bytes given by the length field, so the payload can contain any value.
+ * The CRC is updated with each byte, so it is known as soon as the last byte arrives.
+ */
+static void handleUartPacketByte(Uart *uart_inst, uint8_t c)
+{
+	switch (uart_inst->_rx_state) {
+	case CS_UART_RX_STATE_SYNC:
+		// skip everything in between packets
+		if (c != CS_PACKET_UART_START_TOKEN || uart_inst->_pkt_handler == NULL) {
+			return;
+		}
+		uart_inst->_rx_buf = uart_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
+		// no buffer available, packet is dropped
+		if (uart_inst->_rx_buf == NULL) {
+			return;
+		}
+		*PacketBufferPool::add(uart_inst->_rx_buf, 1) = c;
+		uart_inst->_rx_crc = CS_PACKET_UART_CRC_SEED;
+		uart_inst->_rx_state = CS_UART_RX_STATE_LENGTH;
+		break;
+	case CS_UART_RX_STATE_LENGTH:
+		*PacketBufferPool::add(uart_inst->_rx_buf, 1) = c;
+		if (uart_inst->_rx_buf->len < 3) {
+			return;
+		}
+		uart_inst->_rx_remaining = sys_get_le16(uart_inst->_rx_buf->data + 1);
+		// at least protocol version, type and CRC, and the packet should fit in the buffer
+		if (uart_inst->_rx_remaining < 4 ||
+		    uart_inst->_rx_remaining > PacketBufferPool::tailroom(uart_inst->_rx_buf)) {
+			resetUartRxPacket(uart_inst);
+			return;
+		}
+		uart_inst->_rx_state = CS_UART_RX_STATE_BODY;
+		break;
+	case CS_UART_RX_STATE_BODY:
+		*PacketBufferPool::add(uart_inst->_rx_buf, 1) = c;
+		uart_inst->_rx_crc = cs_crc16_ccitt_update(uart_inst->_rx_crc, c);
+		if (--uart_inst->_rx_remaining > 0) {
+			return;
+		}
+		// the CRC is included in the running CRC, so a valid packet ends at the residue
+		if (uart_inst->_rx_crc != CS_CRC16_CCITT_RESIDUE) {
+			resetUartRxPacket(uart_inst);
+			return;
+		}
+		uart_inst->_rx_buf->rx_crc = uart_inst->_rx_crc;
+		uart_inst->_rx_buf->rx_crc_valid = true;
+		flushUartRxBuffer(uart_inst);
+		uart_inst->_rx_state = CS_UART_RX_STATE_SYNC;
+		break;
+	}
+}
+
+/**
+ * @brief Handle a received byte in idle mode. A frame is ended by silence on the line, which is
+ * marked in the RX ring where the bytes are received.
+ */
+static void handleUartIdleByte(Uart *uart_inst, uint8_t c)
+{
+	if (uart_inst->_rx_buf == NULL && uart_inst->_pkt_handler != NULL) {
+		uart_inst->_rx_buf = uart_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
+	}
+	// no buffer available, byte is dropped
+	if (uart_inst->_rx_buf == NULL) {
+		return;
+	}
+
+	*PacketBufferPool::add(uart_inst->_rx_buf, 1) = c;
+
+	if (PacketBufferPool::tailroom(uart_inst->_rx_buf) == 0) {
+		flushUartRxBuffer(uart_inst);
+	}
+}
+
+/**
+ * @brief Handle a byte taken from the RX ring by the UART thread.
+ * Bytes are written directly into a packet buffer, which is passed on once complete.
+ */
+static void handleUartRxByte(Uart *uart_inst, uint8_t c)
+{
+	switch (uart_inst->_framing) {
+	case CS_UART_FRAMING_PACKET:
+		handleUartPacketByte(uart_inst, c);
+		break;
+	case CS_UART_FRAMING_IDLE:
+		handleUartIdleByte(uart_inst, c);
+		break;
+	default:
+		handleUartLineByte(uart_inst, c);
+		break;
+	}
+}
+
+/**
+ * @brief Take the bytes from the RX ring up to the next frame end, and pass the frame on once the
+ * frame end is reached. Frame ends are marked when the bytes are received, so a late wake up of the
+ * UART thread doesn't merge frames. In packet framing, a packet that is still partial when the
+ * line went silent was truncated, and is dropped so the next packet isn't lost with it.
+ *
+ * @return False once the RX ring is empty.
+ */
+static bool handleUartRxFrame(Uart *uart_inst)
+{
+	uint8_t chunk[CS_UART_RX_CHUNK_SIZE];
+	uint32_t max_len = sizeof(chunk);
+	cs_uart_rx_frame_end end;
+
+	if (k_msgq_peek(&uart_inst->_rx_frame_ends, &end) == 0) {
+		int32_t remaining = end.pos - uart_inst->_rx_ring.getTail();
+		// frame ends before the tail were dropped with the ring when it was cleared
+		if (remaining <= 0) {
+			k_msgq_get(&uart_inst->_rx_frame_ends, &end, K_NO_WAIT);
+			if (uart_inst->_framing != CS_UART_FRAMING_PACKET) {
+				flushUartRxFrame(uart_inst, end.cyc);
+			} else if (uart_inst->_rx_state != CS_UART_RX_STATE_SYNC) {
+				// hunt for the start token of the next packet
+				resetUartRxPacket(uart_inst);
+			}
+			return true;
+		}
+		max_len = MIN(max_len, (uint32_t)remaining);
+	}
+
+	uint32_t len = uart_inst->_rx_ring.get(chunk, max_len);
+	for (uint32_t i = 0; i < len; i++) {
+		handleUartRxByte(uart_inst, chunk[i]);
+	}
+
+	return len > 0;
+}
+
+/**
+ * @brief Thread function that frames the bytes in the RX ring, and passes the frames on.
  *
  * @param inst Pointer to the class instance.
  * @param unused1 Unused parameter, is NULL.
@@ -24,50 +388,263 @@ K_THREAD_STACK_DEFINE(uart_tid_stack_area, CS_UART_THREAD_STACK_SIZE);
 static void handleUartMessages(void *inst, void *unused1, void *unused2)
 {
 	Uart *uart_inst = static_cast<Uart *>(inst);
-	uint8_t msg_buf[CS_UART_BUFFER_SIZE];
 
-	while (1) {
-		// wait till message is retrieved from message queue
-		if (k_msgq_get(&uart_inst->_uart_msgq, &msg_buf, K_FOREVER) == 0) {
-			LOG_HEXDUMP_DBG(msg_buf, (uint32_t)strlen((char *)msg_buf), "uart message");
-
-			cs_packet_data uart_data;
-			memset(&uart_data, 0, sizeof(uart_data));
-			// UART buffers are null terminated, so get length with strlen
-			size_t msg_len = MIN(CS_PACKET_BUF_SIZE, strlen((char *)msg_buf));
-			uart_data.msg.buf_len = msg_len;
-			uart_data.dest_id = uart_inst->_dest_id;
-			memcpy(&uart_data.msg.buf, msg_buf, msg_len);
-
-			// packets sent from CM4 start with a specific token
-			// handle the packet as incoming
-			if (msg_buf[0] == CS_PACKET_UART_START_TOKEN) {
-				uart_data.src_id = CS_INSTANCE_ID_UART_CM4;
-				uart_data.type = CS_DATA_INCOMING;
-			} else {
-				// packet is sent from this instance, use own source id
-				uart_data.src_id = uart_inst->_src_id;
-				uart_data.type = CS_DATA_OUTGOING;
-			}
+	while (!uart_inst->_rx_aborted) {
+		k_sem_take(&uart_inst->_rx_sem, K_FOREVER);
 
-			if (uart_inst->_pkt_handler != NULL) {
-				// dispatch the work item
-				int ret = uart_inst->_pkt_handler->handlePacket(&uart_data);
-				// handler not running due to error, abort
-				if (ret == CS_ERR_ABORTED) {
-					break;
-				}
-			} else {
-				LOG_WRN("%s", "Failed to handle UART message");
-				break;
-			}
+		// the serial parameters changed, the bytes received before are meaningless
+		if (atomic_cas(&uart_inst->_rx_reset, 1, 0)) {
+			uart_inst->_rx_ring.clear();
+			resetUartRxPacket(uart_inst);
+		}
+
+		// frame all bytes that were received
+		while (handleUartRxFrame(uart_inst)) {
+		}
+
+		atomic_val_t dropped = atomic_clear(&uart_inst->_rx_dropped);
+		if (dropped > 0) {
+			LOG_WRN("UART RX ring full, %ld bytes dropped", (long)dropped);
 		}
 	}
 }
 
 /**
- * @brief Handle UART interrupts.
- * Interrupt on RX is handled byte by byte, complete buffers sent to message queue.
+ * @brief Mark the end of a frame, at the bytes that are in the RX ring now.
+ * Called from the interrupt or the timer, once the line went silent.
+ */
+static void markUartFrameEnd(Uart *uart_inst)
+{
+	cs_uart_rx_frame_end end;
+	end.pos = uart_inst->_rx_ring.getHead();
+	end.cyc = uart_inst->_rx_last_cyc;
+
+	// when the UART thread falls this far behind, the frame is merged with the next one
+	k_msgq_put(&uart_inst->_rx_frame_ends, &end, K_NO_WAIT);
+	k_sem_give(&uart_inst->_rx_sem);
+}
+
+/**
+ * @brief The line was silent for the frame gap since bytes were last received.
+ */
+static void handleUartRxGap(k_timer *timer)
+{
+	markUartFrameEnd(static_cast<Uart *>(k_timer_user_data_get(timer)));
+}
+
+/**
+ * @brief Store received bytes in the RX ring, from either the interrupt or the DMA buffers.
+ * The bytes are framed by the UART thread. Bytes that don't fit are dropped and counted.
+ * In idle and packet framing, the gap timer is restarted, its expiry marks the end of the frame.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param data Received bytes.
+ * @param len Amount of bytes.
+ * @param idle Set when the line is known to be silent for the frame gap after these bytes.
+ */
+static void storeUartRxBytes(Uart *uart_inst, const uint8_t *data, uint32_t len, bool idle)
+{
+	// updated before the bytes are stored, so the thread never sees them with an older time
+	uart_inst->_rx_last_cyc = k_cycle_get_32();
+	atomic_add(&uart_inst->_rx_count, len);
+
+	// data received at a wrong baudrate is garbage, it is only counted
+	if (uart_inst->_rx_probing) {
+		return;
+	}
+
+	uint32_t stored = uart_inst->_rx_ring.put(data, len);
+	if (stored < len) {
+		atomic_add(&uart_inst->_rx_dropped, len - stored);
+	}
+
+	// line framing ends its frames on CR or LF only
+	if (uart_inst->_framing != CS_UART_FRAMING_LINE) {
+		if (idle) {
+			k_timer_stop(&uart_inst->_rx_gap_timer);
+			markUartFrameEnd(uart_inst);
+			return;
+		}
+		k_timer_start(&uart_inst->_rx_gap_timer, K_USEC(uart_inst->_rx_timeout_us),
+			      K_NO_WAIT);
+	}
+
+	k_sem_give(&uart_inst->_rx_sem);
+}
+
+/**
+ * @brief Calculate the time it takes to transfer one character.
+ *
+ * @param cfg Serial parameters of the UART.
+ *
+ * @return Character time in us, rounded up.
+ */
+static uint32_t calcCharTimeUs(uart_config *cfg)
+{
+	// start bit and 8 data bits, followed by the optional parity bit and the stop bits
+	uint32_t bits = 1 + 8;
+	bits += cfg->parity != UART_CFG_PARITY_NONE ? 1 : 0;
+	bits += cfg->stop_bits == UART_CFG_STOP_BITS_2 ? 2 : 1;
+
+	if (cfg->baudrate == 0) {
+		return 0;
+	}
+	return DIV_ROUND_UP(bits * USEC_PER_SEC, cfg->baudrate);
+}
+
+/**
+ * @brief Build the serial parameters of the UART. RS485 and RS232 are constrained by their spec,
+ * the CM4 connection only by the baudrates the UART can generate.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param cfg Requested parameters, when NULL the current-speed of the UART in devicetree is used,
+ * with 8,n,1.
+ * @param uart_cfg Parameters to apply.
+ *
+ * @return CS_OK if the requested parameters are valid.
+ */
+static cs_ret_code_t buildUartConfig(Uart *uart_inst, cs_uart_config *cfg, uart_config *uart_cfg)
+{
+	*uart_cfg = {0};
+	uart_cfg->flow_ctrl = UART_CFG_FLOW_CTRL_NONE;
+	uart_cfg->data_bits = UART_CFG_DATA_BITS_8;
+
+	if (cfg == NULL) {
+		uart_cfg->baudrate = uart_inst->_cfg->baudrate;
+		uart_cfg->parity = UART_CFG_PARITY_NONE;
+		uart_cfg->stop_bits = UART_CFG_STOP_BITS_1;
+	} else if (uart_inst->_src_id == CS_INSTANCE_ID_UART_CM4) {
+		// CM4 UART connection is not using any RS protocol, so not constrained by its spec
+		if (cfg->baudrate < CS_UART_CM4_BAUD_MIN || cfg->baudrate > CS_UART_CM4_BAUD_MAX) {
+			LOG_ERR("Invalid baudrate %u provided", cfg->baudrate);
+			return CS_ERR_UART_CONFIG_INVALID;
+		}
+		uart_cfg->baudrate = cfg->baudrate;
+		uart_cfg->parity = cfg->parity;
+		uart_cfg->stop_bits = cfg->stop_bits;
+	} else {
+		// according to RS485 and RS232 spec, baudrate between 110 and 115200
+		uart_cfg->baudrate = CLAMP(cfg->baudrate, CS_UART_RS_BAUD_MIN, CS_UART_RS_BAUD_MAX);
+
+		// use a total of 11 bits
+		switch (cfg->parity) {
+		case UART_CFG_PARITY_ODD:
+		case UART_CFG_PARITY_EVEN:
+			uart_cfg->parity = cfg->parity;
+			uart_cfg->stop_bits = UART_CFG_STOP_BITS_1;
+			break;
+		case UART_CFG_PARITY_NONE:
+			uart_cfg->parity = cfg->parity;
+			uart_cfg->stop_bits = cfg->stop_bits;
+			break;
+		default:
+			LOG_ERR("%s", "Invalid parity bit option provided");
+			return CS_ERR_UART_CONFIG_INVALID;
+		}
+	}
+
+	return CS_OK;
+}
+
+/**
+ * @brief Update the silence after which received data is reported to the serial parameters.
+ * In idle mode, the frame ends after a silence of a number of character times. In packet mode,
+ * the silence drops a truncated packet, so it is never shorter than the default.
+ */
+static void updateUartRxTimeout(Uart *uart_inst)
+{
+	uint32_t char_us = calcCharTimeUs(&uart_inst->_serial_cfg);
+	uint32_t gap_us = DIV_ROUND_UP(char_us * uart_inst->_cfg->frame_gap_tenths, 10);
+
+	switch (uart_inst->_framing) {
+	case CS_UART_FRAMING_IDLE:
+		uart_inst->_rx_timeout_us = gap_us;
+		break;
+	case CS_UART_FRAMING_PACKET:
+		uart_inst->_rx_timeout_us = MAX(gap_us, CS_UART_DMA_RX_TIMEOUT_US);
+		break;
+	default:
+		uart_inst->_rx_timeout_us = CS_UART_DMA_RX_TIMEOUT_US;
+		break;
+	}
+}
+
+#ifdef CONFIG_UART_ASYNC_API
+/**
+ * @brief Release the packet that was transmitted with DMA, and continue with the next packet that
+ * was queued while transmitting.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param sent Set if the packet was transmitted completely, and not aborted or dropped.
+ */
+static void handleUartTxDone(Uart *uart_inst, bool sent)
+{
+	cs_packet_buf *tx_buf = uart_inst->_tx_buf;
+
+	uart_inst->_tx_buf = NULL;
+	if (sent && tx_buf->tx_done != NULL) {
+		k_sem_give(tx_buf->tx_done);
+	}
+	PacketBufferPool::unref(tx_buf);
+
+	if (uart_inst->_tx_hdlr != NULL) {
+		PacketHandler::scheduleNext(uart_inst->_tx_hdlr);
+	}
+}
+
+/**
+ * @brief Handle events of the asynchronous UART API.
+ * Data is received in two DMA buffers, one is filled by the hardware while the data in the other
+ * is handled. Received data is reported when a buffer is full, or when the line goes idle.
+ * It is stored in the RX ring, the end of a frame is detected by the UART thread.
+ */
+static void handleUartAsyncEvent(const device *dev, uart_event *evt, void *user_data)
+{
+	Uart *uart_inst = static_cast<Uart *>(user_data);
+
+	switch (evt->type) {
+	case UART_RX_RDY: {
+		// a buffer that isn't full is reported as the line was silent for the RX timeout,
+		// which is the frame gap in idle framing
+		uint32_t end = evt->data.rx.offset + evt->data.rx.len;
+		storeUartRxBytes(uart_inst, evt->data.rx.buf + evt->data.rx.offset,
+				 evt->data.rx.len, end < CS_UART_DMA_BUF_SIZE);
+		break;
+	}
+	case UART_RX_BUF_REQUEST:
+		uart_rx_buf_rsp(dev, uart_inst->_dma_rx_buf[uart_inst->_dma_rx_next],
+				CS_UART_DMA_BUF_SIZE);
+		uart_inst->_dma_rx_next ^= 1;
+		break;
+	case UART_RX_STOPPED:
+		LOG_WRN("UART RX stopped (reason %d)", evt->data.rx_stop.reason);
+		atomic_inc(&uart_inst->_rx_errors);
+		break;
+	case UART_RX_DISABLED:
+		// restart reception, unless the UART was disabled or paused on purpose
+		if (uart_inst->_rx_paused) {
+			k_sem_give(&uart_inst->_rx_disabled_sem);
+		} else if (uart_inst->_initialized) {
+			uart_inst->_dma_rx_next = 1;
+			uart_rx_enable(dev, uart_inst->_dma_rx_buf[0], CS_UART_DMA_BUF_SIZE,
+				       uart_inst->_rx_timeout_us);
+		}
+		break;
+	case UART_TX_DONE:
+		handleUartTxDone(uart_inst, true);
+		break;
+	case UART_TX_ABORTED:
+		handleUartTxDone(uart_inst, false);
+		break;
+	default:
+		break;
+	}
+}
+#endif
+
+/**
+ * @brief Handle UART interrupts, used when the asynchronous API is not available.
+ * On RX, all bytes in the fifo are moved to the RX ring.
  */
 static void handleUartInterrupt(const device *dev, void *user_data)
 {
@@ -80,59 +657,99 @@ static void handleUartInterrupt(const device *dev, void *user_data)
 
 	// handle interrupt on RX
 	if (uart_irq_rx_ready(dev)) {
-		uint8_t c;
-		// read one byte from the uart fifo queue
-		if (uart_fifo_read(dev, &c, 1) != 1) {
+		uint8_t data[CS_UART_RX_CHUNK_SIZE];
+		int len = uart_fifo_read(dev, data, sizeof(data));
+		if (len < 0) {
 			LOG_ERR("%s", "Failed to read from uart fifo");
 			return;
 		}
 
-		// store characters until line end is detected, or buffer if full
-		if (c == '\n' || c == '\r' ||
-		    uart_inst->_uart_buf_ctr == (CS_UART_BUFFER_SIZE - 1)) {
-			if (uart_inst->_uart_buf_ctr > 0) {
-				// terminate string
-				uart_inst->_uart_buf[uart_inst->_uart_buf_ctr] = '\0';
-
-				// add to message queue, this copies the data to ring buffer
-				// if queue is full, purge old data and try again
-				if (k_msgq_put(&uart_inst->_uart_msgq, &uart_inst->_uart_buf,
-					       K_NO_WAIT) != 0) {
-					k_msgq_purge(&uart_inst->_uart_msgq);
-				}
-				uart_inst->_uart_buf_ctr = 0;
-			}
-		} else if (uart_inst->_uart_buf_ctr < (CS_UART_BUFFER_SIZE - 1)) {
-			uart_inst->_uart_buf[uart_inst->_uart_buf_ctr++] = c;
+		// framing and parity errors are a sign of a wrong baudrate
+		int err = uart_err_check(dev);
+		if (err > 0 && (err & (UART_ERROR_FRAMING | UART_ERROR_PARITY))) {
+			atomic_inc(&uart_inst->_rx_errors);
 		}
+
+		storeUartRxBytes(uart_inst, data, len, false);
 	}
 
-	// handle interrupt on TX
+	// handle interrupt on TX, fill the fifo from the TX ring
 	if (uart_irq_tx_ready(dev)) {
-		if (uart_inst->_uart_buf_ctr > 0) {
-			int n = uart_fifo_fill(dev, uart_inst->_uart_buf_ptr,
-					       uart_inst->_uart_buf_ctr);
-			uart_inst->_uart_buf_ctr -= n;
-			uart_inst->_uart_buf_ptr += n;
+		bool resume = false;
+		uint8_t *data;
+
+		k_spinlock_key_t key = k_spin_lock(&uart_inst->_tx_lock);
+
+		uint32_t len = ring_buf_get_claim(&uart_inst->_tx_ring, &data, UINT32_MAX);
+		int n = len > 0 ? uart_fifo_fill(dev, data, len) : 0;
+		ring_buf_get_finish(&uart_inst->_tx_ring, MAX(n, 0));
+
+		// room was made for a frame that didn't fit
+		if (n > 0 && uart_inst->_tx_waiting) {
+			uart_inst->_tx_waiting = false;
+			resume = true;
 		}
 
 		// check if all bytes were transmitted to avoid corrupted message
-		if (uart_irq_tx_complete(dev)) {
+		if (ring_buf_is_empty(&uart_inst->_tx_ring) && uart_irq_tx_complete(dev)) {
 			uart_irq_tx_disable(dev);
-			uart_irq_rx_enable(dev);
+			// release the bus right away, so the reply of a fast slave is not missed.
+			// Only a long post-delay is timed, it would block interrupts otherwise
+			uint16_t delay_us = uart_inst->_cfg->de_post_delay_us;
+			if (uart_inst->_cfg->de_gpio.port != NULL &&
+			    delay_us > uart_inst->_cfg->de_busy_wait_max_us) {
+				uart_inst->_tx_releasing = true;
+				k_timer_start(&uart_inst->_de_timer, K_USEC(delay_us), K_NO_WAIT);
+			} else {
+				if (uart_inst->_cfg->de_gpio.port != NULL) {
+					k_busy_wait(delay_us);
+				}
+				releaseUartBusLocked(uart_inst);
+			}
 		}
+
+		k_spin_unlock(&uart_inst->_tx_lock, key);
+
+		if (resume) {
+			PacketHandler::schedule(uart_inst->_tx_hdlr);
+		}
+	}
+}
+
+/**
+ * @brief Get the amount of UART instances that are enabled in devicetree.
+ */
+int Uart::getInstanceCount()
+{
+	return ARRAY_SIZE(uart_instances);
+}
+
+/**
+ * @brief Get a UART instance that is enabled in devicetree.
+ *
+ * @param idx Index of the instance, below @ref getInstanceCount.
+ *
+ * @return Pointer to the instance, or NULL if the index is out of range.
+ */
+Uart *Uart::getInstance(int idx)
+{
+	if (idx < 0 || idx >= getInstanceCount()) {
+		return NULL;
 	}
+
+	return uart_instances[idx];
 }
 
 /**
  * @brief Initialize the UART module.
  *
  * @param cfg Optional struct with custom baudrate, parity and stop bits.
- * when NULL is provided, 9600,8,n,1 is used.
+ * when NULL is provided, the current-speed of the UART in devicetree is used, with 8,n,1.
+ * @param handler PacketHandler instance received data is handed to.
  *
  * @return CS_OK if the UART module was sucessfully initialized.
  */
-cs_ret_code_t Uart::init(cs_uart_config *cfg)
+cs_ret_code_t Uart::init(cs_uart_config *cfg, PacketHandler *handler)
 {
 	if (_initialized) {
 		LOG_ERR("%s", "Already initialized");
@@ -145,96 +762,411 @@ cs_ret_code_t Uart::init(cs_uart_config *cfg)
 		return CS_ERR_DEVICE_NOT_READY;
 	}
 
-	// configure uart parameters
-	uart_config uart_cfg = {0};
-	uart_cfg.flow_ctrl = UART_CFG_FLOW_CTRL_NONE;
-	uart_cfg.data_bits = UART_CFG_DATA_BITS_8;
+	_pkt_handler = handler;
 
-	if (cfg == NULL) {
-		uart_cfg.baudrate = CS_UART_RS_BAUD_DEFAULT;
-		uart_cfg.parity = UART_CFG_PARITY_NONE;
-		uart_cfg.stop_bits = UART_CFG_STOP_BITS_1;
-	} else {
-		if (_src_id == CS_INSTANCE_ID_UART_CM4) {
-			// CM4 UART connection is not using any RS protocol, so not constrained
-			uart_cfg.baudrate = cfg->baudrate;
-			uart_cfg.parity = cfg->parity;
-			uart_cfg.stop_bits = cfg->stop_bits;
-		} else {
-			// according to RS485 and RS232 spec, baudrate between 110 and 115200
-			uart_cfg.baudrate =
-				CLAMP(cfg->baudrate, CS_UART_RS_BAUD_MIN, CS_UART_RS_BAUD_MAX);
-
-			// use a total of 11 bits
-			switch (cfg->parity) {
-			case UART_CFG_PARITY_ODD:
-			case UART_CFG_PARITY_EVEN:
-				uart_cfg.parity = cfg->parity;
-				uart_cfg.stop_bits = UART_CFG_STOP_BITS_1;
-				break;
-			case UART_CFG_PARITY_NONE:
-				uart_cfg.parity = cfg->parity;
-				uart_cfg.stop_bits = cfg->stop_bits;
-				break;
-			default:
-				LOG_ERR("%s", "Invalid parity bit option provided");
-				return CS_ERR_UART_CONFIG_INVALID;
-			}
-		}
+	// configure uart parameters
+	uart_config uart_cfg;
+	cs_ret_code_t ret = buildUartConfig(this, cfg, &uart_cfg);
+	if (ret != CS_OK) {
+		return ret;
 	}
 
 	if (uart_configure(_uart_dev, &uart_cfg) != 0) {
 		LOG_ERR("%s", "Failed to configure uart");
 		return CS_ERR_UART_CONFIG_FAILED;
 	}
+	_serial_cfg = uart_cfg;
+
+	// transceiver driver is only enabled while transmitting
+	if (_cfg->de_gpio.port != NULL) {
+		if (!device_is_ready(_cfg->de_gpio.port) ||
+		    gpio_pin_configure_dt(&_cfg->de_gpio, GPIO_OUTPUT_INACTIVE) != 0) {
+			LOG_ERR("%s", "Failed to configure driver enable pin");
+			return CS_ERR_UART_CONFIG_FAILED;
+		}
+		k_timer_init(&_de_timer, handleUartDriverRelease, NULL);
+		k_timer_user_data_set(&_de_timer, this);
+	}
+
+	updateUartRxTimeout(this);
+
+	_rx_state = CS_UART_RX_STATE_SYNC;
+	ring_buf_init(&_tx_ring, _cfg->tx_ring_size, _cfg->tx_ring_buf);
+
+	// received bytes are passed from the interrupt to the UART thread through the RX ring
+	_rx_ring.init(_cfg->rx_ring_buf, _cfg->rx_ring_size);
+	k_sem_init(&_rx_sem, 0, 1);
+	k_msgq_init(&_rx_frame_ends, (char *)_rx_frame_ends_buf, sizeof(cs_uart_rx_frame_end),
+		    CS_UART_RX_FRAME_ENDS);
+	k_timer_init(&_rx_gap_timer, handleUartRxGap, NULL);
+	k_timer_user_data_set(&_rx_gap_timer, this);
+
+#ifdef CONFIG_UART_ASYNC_API
+	// use DMA when the driver of this UART supports it, pass pointer to this class object.
+	// TX done only means the DMA finished, not that the shift register is empty. Half-duplex
+	// instances and instances with a driver enable pin keep using the interrupt driven API,
+	// so the bus is released once the TX interrupt reports the transmission complete.
+	if (!_half_duplex && _cfg->de_gpio.port == NULL) {
+		_async = uart_callback_set(_uart_dev, handleUartAsyncEvent, this) == 0;
+	}
+	if (_async) {
+		k_sem_init(&_rx_disabled_sem, 0, 1);
+		_dma_rx_next = 1;
+		if (uart_rx_enable(_uart_dev, _dma_rx_buf[0], CS_UART_DMA_BUF_SIZE,
+				   _rx_timeout_us) != 0) {
+			LOG_ERR("%s", "Failed to enable uart RX");
+			return CS_ERR_UART_CONFIG_FAILED;
+		}
+	}
+#endif
 
-	// initialize message queue, aligned to 4-byte boundary
-	k_msgq_init(&_uart_msgq, _msgq_buf, CS_UART_BUFFER_SIZE, CS_UART_BUFFER_QUEUE_SIZE);
+	if (!_async) {
+		// set ISR, pass pointer to this class object as user data
+		uart_irq_callback_user_data_set(_uart_dev, handleUartInterrupt, this);
+
+		// start listening on RX
+		uart_irq_rx_enable(_uart_dev);
+	}
 
-	// set ISR, pass pointer to this class object as user data
-	uart_irq_callback_user_data_set(_uart_dev, handleUartInterrupt, this);
+	// start dedicated work queue for transmitting packets, given to the PacketHandler
+	k_work_queue_config workq_cfg = {0};
+	workq_cfg.name = _cfg->name;
 
-	// start listening on RX
-	uart_irq_rx_enable(_uart_dev);
+	k_work_queue_init(&_uart_workq);
+	k_work_queue_start(&_uart_workq, _cfg->workq_stack, _cfg->workq_stack_size,
+			   CS_UART_WORKQ_PRIORITY, &workq_cfg);
 
-	// create thread for handling uart messages
-	k_tid_t uart_thread = k_thread_create(
-		&_uart_tid, uart_tid_stack_area, K_THREAD_STACK_SIZEOF(uart_tid_stack_area),
-		handleUartMessages, this, NULL, NULL, CS_UART_THREAD_PRIORITY, 0, K_NO_WAIT);
+	// create thread for handling uart messages, on the stack of this instance
+	k_tid_t uart_thread = k_thread_create(&_uart_tid, _cfg->thread_stack,
+					      _cfg->thread_stack_size, handleUartMessages, this,
+					      NULL, NULL, CS_UART_THREAD_PRIORITY, 0, K_NO_WAIT);
 
 	_initialized = true;
 
 	return CS_OK;
 }
 
+/**
+ * @brief Wait till all pending data is transmitted. The active flag is cleared once the bus is
+ * released after the last byte, a DMA transmission holds its buffer till it is done.
+ *
+ * @return CS_OK if the transmitter is idle, CS_ERR_TIMEOUT if it didn't finish in time.
+ */
+static cs_ret_code_t drainUartTx(Uart *uart_inst)
+{
+	int64_t deadline = k_uptime_get() + CS_UART_DRAIN_TIMEOUT_MS;
+
+	while (uart_inst->_tx_active || uart_inst->_tx_buf != NULL) {
+		if (k_uptime_get() >= deadline) {
+			LOG_WRN("%s", "Timed out waiting for uart TX to drain");
+			return CS_ERR_TIMEOUT;
+		}
+		k_sleep(K_MSEC(1));
+	}
+
+	return CS_OK;
+}
+
+/**
+ * @brief Stop reception while the serial parameters are changed.
+ */
+static void pauseUartRx(Uart *uart_inst)
+{
+#ifdef CONFIG_UART_ASYNC_API
+	if (uart_inst->_async) {
+		// disabling completes asynchronously, wait for it so reception can be enabled again
+		uart_inst->_rx_paused = true;
+		k_sem_reset(&uart_inst->_rx_disabled_sem);
+		if (uart_rx_disable(uart_inst->_uart_dev) == 0) {
+			k_sem_take(&uart_inst->_rx_disabled_sem, K_MSEC(CS_UART_DRAIN_TIMEOUT_MS));
+		}
+		return;
+	}
+#endif
+	uart_irq_rx_disable(uart_inst->_uart_dev);
+}
+
+/**
+ * @brief Start reception again. The UART thread drops the bytes and the partial frame that were
+ * received with the previous serial parameters.
+ */
+static void resumeUartRx(Uart *uart_inst)
+{
+	atomic_set(&uart_inst->_rx_reset, 1);
+	k_sem_give(&uart_inst->_rx_sem);
+
+#ifdef CONFIG_UART_ASYNC_API
+	if (uart_inst->_async) {
+		uart_inst->_rx_paused = false;
+		uart_inst->_dma_rx_next = 1;
+		uart_rx_enable(uart_inst->_uart_dev, uart_inst->_dma_rx_buf[0],
+			       CS_UART_DMA_BUF_SIZE, uart_inst->_rx_timeout_us);
+		return;
+	}
+#endif
+	uart_irq_rx_enable(uart_inst->_uart_dev);
+}
+
+/**
+ * @brief Apply a set config command to this UART.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param cfg_hdr Config type, config id and persistence mode of the command.
+ * @param payload Payload according to the config type.
+ * @param len Length of the payload.
+ *
+ * @return Result code of the command.
+ */
+static cs_router_result_code setUartConfig(Uart *uart_inst, uint8_t *cfg_hdr, uint8_t *payload,
+					   uint16_t len)
+{
+	cs_uart_config cfg;
+	cfg.parity = (uart_config_parity)uart_inst->_serial_cfg.parity;
+	cfg.stop_bits = (uart_config_stop_bits)uart_inst->_serial_cfg.stop_bits;
+
+	// there is no storage for the settings, they are lost on reset
+	if (cfg_hdr[2] != CS_SET_CONFIG_PERSISTENCE_MODE_TEMPORARY) {
+		return CS_RESUKT_TYPE_NOT_IMPLEMENTED;
+	}
+
+	switch (cfg_hdr[0]) {
+	case CS_CONFIG_TYPE_UART_BAUDRATE:
+		if (len != sizeof(uint32_t)) {
+			return CS_RESULT_TYPE_WRONG_PAYLOAD_LENGTH;
+		}
+		cfg.baudrate = sys_get_le32(payload);
+		break;
+	case CS_CONFIG_TYPE_UART_SERIAL:
+		if (len != sizeof(uint32_t) + 2) {
+			return CS_RESULT_TYPE_WRONG_PAYLOAD_LENGTH;
+		}
+		cfg.baudrate = sys_get_le32(payload);
+		cfg.parity = (uart_config_parity)payload[4];
+		cfg.stop_bits = (uart_config_stop_bits)payload[5];
+		break;
+	default:
+		return CS_RESULT_TYPE_UNKNOWN_TYPE;
+	}
+
+	cs_ret_code_t ret;
+	if (cfg_hdr[0] == CS_CONFIG_TYPE_UART_BAUDRATE && cfg.baudrate == 0) {
+		ret = uart_inst->detectBaudrate(&cfg.baudrate);
+	} else {
+		ret = uart_inst->configure(&cfg);
+	}
+
+	switch (ret) {
+	case CS_OK:
+		return CS_RESULT_TYPE_SUCCES;
+	case CS_ERR_UART_CONFIG_INVALID:
+		return CS_RESULT_TYPE_MISMATCH;
+	case CS_ERR_TIMEOUT:
+	case CS_ERR_UART_BAUDRATE_NOT_DETECTED:
+		return CS_RESULT_TYPE_TIMEOUT;
+	default:
+		return CS_RESULT_TYPE_UNSPECIFIED;
+	}
+}
+
+/**
+ * @brief Get the config of this UART requested by a get config command.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param cfg_hdr Config type, config id and persistence mode of the command.
+ * @param payload Buffer of at least 6 bytes, the payload according to the config type.
+ * @param len Length of the payload.
+ *
+ * @return Result code of the command.
+ */
+static cs_router_result_code getUartConfig(Uart *uart_inst, uint8_t *cfg_hdr, uint8_t *payload,
+					   uint16_t *len)
+{
+	if (cfg_hdr[2] != CS_GET_CONFIG_PERSISTENCE_MODE_CURRENT) {
+		return CS_RESUKT_TYPE_NOT_IMPLEMENTED;
+	}
+
+	switch (cfg_hdr[0]) {
+	case CS_CONFIG_TYPE_UART_BAUDRATE:
+		sys_put_le32(uart_inst->_serial_cfg.baudrate, payload);
+		*len = sizeof(uint32_t);
+		return CS_RESULT_TYPE_SUCCES;
+	case CS_CONFIG_TYPE_UART_SERIAL:
+		sys_put_le32(uart_inst->_serial_cfg.baudrate, payload);
+		payload[4] = uart_inst->_serial_cfg.parity;
+		payload[5] = uart_inst->_serial_cfg.stop_bits;
+		*len = sizeof(uint32_t) + 2;
+		return CS_RESULT_TYPE_SUCCES;
+	default:
+		return CS_RESULT_TYPE_UNKNOWN_TYPE;
+	}
+}
+
+/**
+ * @brief Handle a set or get config command addressed to this UART, instead of transmitting it.
+ * Other commands are transmitted as is, their payload is meant for the connected device.
+ * Called when all data queued before the command was handed to the transmitter.
+ *
+ * @param uart_inst Pointer to the class instance.
+ * @param buf Packet buffer taken from the transmit queue.
+ *
+ * @return True if the buffer was a config command and is consumed.
+ */
+static bool handleUartCommand(Uart *uart_inst, cs_packet_buf *buf)
+{
+	if (buf->type != CS_DATA_INCOMING || (buf->command_type != CS_COMMAND_TYPE_SET_CONFIG &&
+					      buf->command_type != CS_COMMAND_TYPE_GET_CONFIG)) {
+		return false;
+	}
+
+	// set and get config packets start with the same fields, and end with a reserved byte
+	uint8_t cfg_hdr[3] = {0};
+	uint8_t cfg_payload[sizeof(uint32_t) + 2];
+	uint16_t cfg_payload_len = 0;
+	cs_router_result_code result_code;
+
+	if (buf->len < sizeof(cs_router_get_config_packet)) {
+		result_code = CS_RESULT_TYPE_WRONG_PAYLOAD_LENGTH;
+	} else {
+		memcpy(cfg_hdr, buf->data, sizeof(cfg_hdr));
+		if (buf->command_type == CS_COMMAND_TYPE_SET_CONFIG) {
+			result_code = setUartConfig(uart_inst, cfg_hdr, buf->data + sizeof(cfg_hdr),
+						    buf->len - sizeof(cfg_hdr) - 1);
+		} else {
+			result_code = getUartConfig(uart_inst, cfg_hdr, cfg_payload,
+						    &cfg_payload_len);
+		}
+	}
+
+	// no result is expected without request id
+	if (buf->request_id == 0 || uart_inst->_pkt_handler == NULL) {
+		PacketBufferPool::unref(buf);
+		return true;
+	}
+
+	PacketBufferPool::reset(buf);
+	uint8_t *result = PacketBufferPool::add(buf, sizeof(cfg_hdr) + cfg_payload_len + 1);
+	memcpy(result, cfg_hdr, sizeof(cfg_hdr));
+	memcpy(result + sizeof(cfg_hdr), cfg_payload, cfg_payload_len);
+	result[sizeof(cfg_hdr) + cfg_payload_len] = 0;
+
+	// the packet handler matches it with the pending request, which turns it into a result
+	buf->type = CS_DATA_OUTGOING;
+	buf->src_id = uart_inst->_src_id;
+	buf->dest_id = uart_inst->_dest_id;
+	buf->result_code = result_code;
+	uart_inst->_pkt_handler->handlePacket(buf);
+
+	return true;
+}
+
+/**
+ * @brief Copy queued packets into the TX ring, which is drained by the TX interrupt.
+ * Packets are copied as long as they fit as a whole, so multiple frames can be sent back to
+ * back. A packet that doesn't fit is kept until the interrupt made room for it.
+ */
+static void fillUartTxRing(Uart *uart_inst, cs_packet_handler *hdlr)
+{
+	while (1) {
+		if (uart_inst->_tx_buf == NULL) {
+			cs_packet_buf *next = PacketHandler::takePacket(hdlr);
+			// commands are handled in order, once everything before them is in the ring
+			if (next != NULL && handleUartCommand(uart_inst, next)) {
+				continue;
+			}
+			uart_inst->_tx_buf = next;
+		}
+		if (uart_inst->_tx_buf == NULL) {
+			return;
+		}
+
+		cs_packet_buf *buf = uart_inst->_tx_buf;
+		if (buf->len > uart_inst->_cfg->tx_ring_size) {
+			LOG_WRN("%s", "Packet does not fit in the uart TX ring, dropped");
+			uart_inst->_tx_buf = NULL;
+			PacketBufferPool::unref(buf);
+			continue;
+		}
+
+		k_spinlock_key_t key = k_spin_lock(&uart_inst->_tx_lock);
+
+		// claim the bus when idle, the driver is enabled without the lock held
+		if (!uart_inst->_tx_active) {
+			uart_inst->_tx_active = true;
+			if (uart_inst->_half_duplex) {
+				uart_irq_rx_disable(uart_inst->_uart_dev);
+			}
+			k_spin_unlock(&uart_inst->_tx_lock, key);
+			enableUartDriver(uart_inst);
+			key = k_spin_lock(&uart_inst->_tx_lock);
+		}
+		// the bus is kept for this frame, in case its release is pending
+		uart_inst->_tx_releasing = false;
+
+		if (ring_buf_space_get(&uart_inst->_tx_ring) < buf->len) {
+			uart_inst->_tx_waiting = true;
+			k_spin_unlock(&uart_inst->_tx_lock, key);
+			return;
+		}
+
+		ring_buf_put(&uart_inst->_tx_ring, buf->data, buf->len);
+		// the bus is released after the last byte in the ring, which includes this packet
+		if (buf->tx_done != NULL) {
+			uart_inst->_tx_done = buf->tx_done;
+		}
+		// enabling is done with the lock held, so the interrupt can't disable it in between
+		uart_irq_tx_enable(uart_inst->_uart_dev);
+
+		k_spin_unlock(&uart_inst->_tx_lock, key);
+
+		uart_inst->_tx_buf = NULL;
+		PacketBufferPool::unref(buf);
+	}
+}
+
 /**
  * @brief Transmit a message over UART. Callback function for PacketHandler.
+ * Returns right away, the data is transmitted by the interrupt or DMA.
  *
- * @param inst Pointer to UART class instance.
- * @param message Pointer to buffer with the message.
- * @param len Length of the message.
+ * @param work Pointer to the work item of the packet handler.
  */
 void Uart::sendUartMessage(k_work *work)
 {
 	cs_packet_handler *hdlr = CONTAINER_OF(work, cs_packet_handler, work_item);
 	Uart *uart_inst = static_cast<Uart *>(hdlr->target_inst);
-	k_spinlock_key_t key;
 
 	if (!uart_inst->_initialized) {
 		LOG_ERR("%s", "Not initialized");
 		return;
 	}
 
-	key = k_spin_lock(&hdlr->work_lock);
+	uart_inst->_tx_hdlr = hdlr;
+
+#ifdef CONFIG_UART_ASYNC_API
+	if (uart_inst->_async) {
+		// a transmission is still ongoing, pending packet is picked up once it completes
+		if (uart_inst->_tx_buf != NULL) {
+			return;
+		}
 
-	memcpy(uart_inst->_uart_buf, hdlr->msg.buf, hdlr->msg.buf_len);
-	uart_inst->_uart_buf_ctr = hdlr->msg.buf_len;
-	uart_inst->_uart_buf_ptr = &uart_inst->_uart_buf[0];
+		// the packet buffer is transmitted directly with DMA, without copying
+		cs_packet_buf *buf = PacketHandler::takePacket(hdlr);
+		while (buf != NULL && handleUartCommand(uart_inst, buf)) {
+			buf = PacketHandler::takePacket(hdlr);
+		}
+		if (buf == NULL) {
+			return;
+		}
 
-	k_spin_unlock(&hdlr->work_lock, key);
+		uart_inst->_tx_buf = buf;
+		if (uart_tx(uart_inst->_uart_dev, buf->data, buf->len, SYS_FOREVER_US) != 0) {
+			LOG_WRN("%s", "Failed to start uart TX, packet dropped");
+			handleUartTxDone(uart_inst, false);
+		}
+		return;
+	}
+#endif
 
-	uart_irq_rx_disable(uart_inst->_uart_dev);
-	uart_irq_tx_enable(uart_inst->_uart_dev);
+	fillUartTxRing(uart_inst, hdlr);
 }
 
 /**
@@ -242,15 +1174,156 @@ void Uart::sendUartMessage(k_work *work)
  */
 void Uart::disable()
 {
+#ifdef CONFIG_UART_ASYNC_API
+	if (_async) {
+		// prevent reception from being restarted once it is disabled
+		_initialized = false;
+		uart_rx_disable(_uart_dev);
+		uart_tx_abort(_uart_dev);
+		return;
+	}
+#endif
 	uart_irq_rx_disable(_uart_dev);
 	uart_irq_tx_disable(_uart_dev);
 }
 
+/**
+ * @brief Change the serial parameters while running. Pending data is transmitted first, and the
+ * frame that is being received is dropped. Called from the work queue of this UART, so no new
+ * data is transmitted in between.
+ *
+ * @param cfg Struct with baudrate, parity and stop bits, constrained like in @ref init.
+ *
+ * @return CS_OK if the parameters were applied, else the previous parameters are kept.
+ */
+cs_ret_code_t Uart::configure(cs_uart_config *cfg)
+{
+	if (!_initialized) {
+		LOG_ERR("%s", "Not initialized");
+		return CS_ERR_NOT_INITIALIZED;
+	}
+
+	uart_config uart_cfg;
+	cs_ret_code_t ret = buildUartConfig(this, cfg, &uart_cfg);
+	if (ret != CS_OK) {
+		return ret;
+	}
+
+	ret = drainUartTx(this);
+	if (ret != CS_OK) {
+		return ret;
+	}
+
+	pauseUartRx(this);
+
+	if (uart_configure(_uart_dev, &uart_cfg) == 0) {
+		_serial_cfg = uart_cfg;
+	} else {
+		LOG_ERR("%s", "Failed to configure uart, keeping previous parameters");
+		uart_configure(_uart_dev, &_serial_cfg);
+		ret = CS_ERR_UART_CONFIG_FAILED;
+	}
+	updateUartRxTimeout(this);
+
+	resumeUartRx(this);
+
+	return ret;
+}
+
+/**
+ * @brief Probe the baudrate of the connected device, by listening at each of
+ * @ref CS_UART_AUTOBAUD_RATES. The first baudrate at which data is received without framing or
+ * parity errors is kept. The device should be sending during the probe, parity and stop bits are
+ * not changed. Received data is dropped while probing.
+ *
+ * @param baudrate The detected baudrate.
+ *
+ * @return CS_OK if a baudrate was detected, else the previous baudrate is restored.
+ */
+cs_ret_code_t Uart::detectBaudrate(uint32_t *baudrate)
+{
+	static const uint32_t rates[] = {CS_UART_AUTOBAUD_RATES};
+	cs_ret_code_t ret = CS_ERR_UART_BAUDRATE_NOT_DETECTED;
+
+	cs_uart_config cfg;
+	cfg.parity = (uart_config_parity)_serial_cfg.parity;
+	cfg.stop_bits = (uart_config_stop_bits)_serial_cfg.stop_bits;
+	uint32_t prev_baudrate = _serial_cfg.baudrate;
+
+	_rx_probing = true;
+
+	for (size_t i = 0; i < ARRAY_SIZE(rates); i++) {
+		cfg.baudrate = rates[i];
+		if (configure(&cfg) != CS_OK) {
+			continue;
+		}
+
+		atomic_clear(&_rx_count);
+		atomic_clear(&_rx_errors);
+		k_msleep(CS_UART_AUTOBAUD_WINDOW_MS);
+
+		if (atomic_get(&_rx_count) >= CS_UART_AUTOBAUD_MIN_BYTES &&
+		    atomic_get(&_rx_errors) == 0) {
+			ret = CS_OK;
+			break;
+		}
+	}
+
+	_rx_probing = false;
+
+	if (ret != CS_OK) {
+		LOG_WRN("%s", "No baudrate detected, restoring previous baudrate");
+		cfg.baudrate = prev_baudrate;
+		configure(&cfg);
+		return ret;
+	}
+
+	*baudrate = _serial_cfg.baudrate;
+	LOG_INF("Detected baudrate %u", *baudrate);
+
+	return CS_OK;
+}
+
+/**
+ * @brief Hand the received frames to a protocol running on top of this UART, instead of routing
+ * them through the packet handler. Set before any frames are received, e.g. right after init.
+ *
+ * @param cb Callback that takes the received frames, NULL to route them again
+ * @param ctx Context passed to the callback
+ */
+void Uart::setRxCallback(cs_uart_rx_cb_t cb, void *ctx)
+{
+	_rx_cb_ctx = ctx;
+	_rx_cb = cb;
+}
+
+/**
+ * @brief Route a frame taken by the receive callback through the packet handler after all, like
+ * the frames received without a callback. Called from the receive callback.
+ *
+ * @param buf Received frame, the reference is moved.
+ */
+void Uart::routeFrame(cs_packet_buf *buf)
+{
+	routeUartFrame(this, buf);
+}
+
+/**
+ * @brief Get the time it takes to transfer one character with the current serial parameters.
+ *
+ * @return Character time in us, rounded up.
+ */
+uint32_t Uart::getCharTimeUs()
+{
+	return calcCharTimeUs(&_serial_cfg);
+}
+
 /**
  * @brief Free all allocated memory.
  */
 Uart::~Uart()
 {
 	disable();
-	k_msgq_cleanup(&_uart_msgq);
+	PacketBufferPool::unref(_rx_buf);
+	PacketBufferPool::unref(_tx_buf);
 }
\ No newline at end of file
@@ -11,24 +11,21 @@
 LOG_MODULE_REGISTER(cs_Socket, LOG_LEVEL_INF);
 
 #include <stdio.h>
+#include <string.h>
 
 /**
- * @brief Initialize socket for a domain name.
- * Uses DNS to determine address.
+ * @brief Resolve a domain name using DNS. The previously resolved address is only replaced once
+ * the lookup succeeded.
  *
- * @param domain_name Name of the domain. For example: crownstone.rocks, max 64 characters
+ * @param domain_name Name of the domain.
  * @param port Port that the connection should be opened on
  *
- * @return CS_OK if the initialization is successful.
+ * @return CS_OK if the host was resolved.
  */
-cs_ret_code_t Socket::init(const char *domain_name, uint16_t port)
+cs_ret_code_t Socket::resolveHost(const char *domain_name, uint16_t port)
 {
-	if (_initialized) {
-		LOG_ERR("%s", "Already initialized");
-		return CS_ERR_ALREADY_INITIALIZED;
-	}
-
 	zsock_addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
@@ -38,20 +35,66 @@ cs_ret_code_t Socket::init(const char *domain_name, uint16_t port)
 	sprintf(port_str, "%u", port);
 
 	// resolve host using DNS
-	if (zsock_getaddrinfo(domain_name, port_str, &hints, &_res) != 0) {
+	zsock_addrinfo *res;
+	if (zsock_getaddrinfo(domain_name, port_str, &hints, &res) != 0) {
 		LOG_ERR("%s", "Unable to resolve host address");
 		return CS_ERR_SOCKET_UNABLE_TO_RESOLVE_HOST;
 	}
 
+	zsock_freeaddrinfo(_res);
+	_res = res;
 	_addr = *_res->ai_addr;
-	strncpy(_host, domain_name, sizeof(_host));
+	_addr_len = _res->ai_addrlen;
 
-	_sock_id = zsock_socket(_res->ai_family, _res->ai_socktype, _res->ai_protocol);
+	return CS_OK;
+}
+
+/**
+ * @brief Create a TCP socket for the address of the host.
+ *
+ * @return CS_OK if the socket was created.
+ */
+cs_ret_code_t Socket::createSocket()
+{
+	_sock_id = zsock_socket(_addr.sa_family, SOCK_STREAM, IPPROTO_TCP);
 	if (_sock_id < 0) {
 		LOG_ERR("%s", "Failed to create socket for domain");
 		return CS_ERR_SOCKET_CREATION_FAILED;
 	}
 
+	return CS_OK;
+}
+
+/**
+ * @brief Initialize socket for a domain name.
+ * Uses DNS to determine address.
+ *
+ * @param domain_name Name of the domain. For example: crownstone.rocks, max 64 characters
+ * @param port Port that the connection should be opened on
+ *
+ * @return CS_OK if the initialization is successful.
+ */
+cs_ret_code_t Socket::init(const char *domain_name, uint16_t port)
+{
+	if (_initialized) {
+		LOG_ERR("%s", "Already initialized");
+		return CS_ERR_ALREADY_INITIALIZED;
+	}
+
+	cs_ret_code_t ret = resolveHost(domain_name, port);
+	if (ret != CS_OK) {
+		return ret;
+	}
+
+	strncpy(_host, domain_name, sizeof(_host));
+	_port = port;
+	_use_dns = true;
+
+	ret = createSocket();
+	if (ret != CS_OK) {
+		return ret;
+	}
+
 	_initialized = true;
 
 	return CS_OK;
@@ -87,11 +130,13 @@ cs_ret_code_t Socket::init(const char *peer_addr, cs_socket_ip ip_ver, uint16_t
 	}
 
 	strncpy(_host, peer_addr, sizeof(_host));
+	_port = port;
+	_ip_ver = ip_ver;
+	_use_dns = false;
 
-	_sock_id = zsock_socket(_addr.sa_family, SOCK_STREAM, IPPROTO_TCP);
-	if (_sock_id < 0) {
-		LOG_ERR("%s", "Failed to create socket for domain");
-		return CS_ERR_SOCKET_CREATION_FAILED;
+	cs_ret_code_t ret = createSocket();
+	if (ret != CS_OK) {
+		return ret;
 	}
 
 	_initialized = true;
@@ -99,6 +144,30 @@ cs_ret_code_t Socket::init(const char *peer_addr, cs_socket_ip ip_ver, uint16_t
 	return CS_OK;
 }
 
+/**
+ * @brief Create a new socket for the host given at initialization, e.g. to reconnect after the
+ * connection was lost. The previous socket is closed. A domain name is resolved again, as its
+ * address may have changed in the meantime. When that fails, the previous address is used.
+ * The socket stays initialized if this fails, so it can be tried again later.
+ *
+ * @return CS_OK if the socket was created.
+ */
+cs_ret_code_t Socket::reinit()
+{
+	if (!_initialized) {
+		LOG_ERR("%s", "Not initialized");
+		return CS_ERR_NOT_INITIALIZED;
+	}
+
+	close();
+
+	if (_use_dns && resolveHost(_host, _port) != CS_OK) {
+		LOG_WRN("%s", "Using the previously resolved host address");
+	}
+
+	return createSocket();
+}
+
 /**
  * @brief Close socket.
  *
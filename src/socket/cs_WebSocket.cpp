@@ -12,6 +12,9 @@ LOG_MODULE_REGISTER(cs_WebSocket, LOG_LEVEL_INF);
 
 #include <zephyr/net/socket.h>
 #include <zephyr/net/websocket.h>
+#include <zephyr/posix/sys/eventfd.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/sys/byteorder.h>
 
 #include <string.h>
 #include <stdio.h>
@@ -25,90 +28,432 @@ K_THREAD_STACK_DEFINE(ws_tid_stack_area, CS_WEBSOCKET_THREAD_STACK_SIZE);
  */
 static int handleWebsocketConnect(int ws_sock, http_request *req, void *user_data)
 {
-	WebSocket *ws_inst = static_cast<WebSocket *>(user_data);
+	LOG_INF("Websocket %d connected", ws_sock);
 
-	k_event_post(&ws_inst->_ws_evts, CS_WEBSOCKET_CONNECTED_EVENT);
+	return 0;
+}
 
-	LOG_INF("Websocket %d connected", ws_sock);
+/**
+ * @brief Block until the websocket is ready for the given events, the connection thread is woken
+ * up, or the timeout expires.
+ *
+ * @param ws_inst Pointer to the class instance.
+ * @param events Poll events to wait for on the websocket, 0 to only wait for a wakeup.
+ * @param timeout_ms Time to wait in ms, SYS_FOREVER_MS to wait without timeout.
+ *
+ * @return 0 if the websocket is ready, -EINTR if the thread was woken up, -EAGAIN on timeout,
+ * or a negative errno if polling failed.
+ */
+static int waitWebsocket(WebSocket *ws_inst, short events, int timeout_ms)
+{
+	zsock_pollfd fds[2];
+
+	// negative descriptors are ignored by poll
+	fds[0].fd = events != 0 ? ws_inst->_websock_id : -1;
+	fds[0].events = events;
+	fds[1].fd = ws_inst->_ws_wake_fd;
+	fds[1].events = ZSOCK_POLLIN;
+
+	int ret = zsock_poll(fds, ARRAY_SIZE(fds), timeout_ms);
+	if (ret < 0) {
+		return -errno;
+	}
+	if (ret == 0) {
+		return -EAGAIN;
+	}
+
+	if (fds[1].revents & ZSOCK_POLLIN) {
+		eventfd_t value;
+		eventfd_read(ws_inst->_ws_wake_fd, &value);
+		return -EINTR;
+	}
+
+	// errors and hangups are reported by the next receive
+	return 0;
+}
+
+/**
+ * @brief Drop the rest of the message that is being received. A consumer that already received
+ * fragments of it is told the message was aborted.
+ *
+ * @param ws_inst Pointer to the class instance.
+ */
+static void abortRxMessage(WebSocket *ws_inst)
+{
+	if (ws_inst->_ws_rx_offset > 0 && !ws_inst->_ws_rx_discard && ws_inst->_rx_cb != NULL) {
+		ws_inst->_rx_cb(NULL, ws_inst->_ws_rx_offset, true, ws_inst->_rx_cb_ctx);
+	}
+	ws_inst->_ws_rx_offset = 0;
+	ws_inst->_ws_rx_discard = false;
+}
+
+/**
+ * @brief Close the websocket, or only the socket if the websocket was not connected. Once
+ * connected, the websocket owns the socket underneath it and closes it on disconnect. The socket
+ * is then forgotten instead of closed again, as its descriptor may already belong to another one.
+ *
+ * @param ws_inst Pointer to the class instance.
+ */
+static void disconnectWebsocket(WebSocket *ws_inst)
+{
+	if (ws_inst->_websock_id < 0) {
+		ws_inst->Socket::close();
+		return;
+	}
+
+	// the close frame would otherwise be taken as the rest of the frame that was partly sent
+	if (ws_inst->_ws_tx_pos > 0) {
+		zsock_shutdown(ws_inst->_sock_id, ZSOCK_SHUT_WR);
+	}
+	websocket_disconnect(ws_inst->_websock_id);
+	ws_inst->_websock_id = -1;
+	ws_inst->_sock_id = -1;
+}
+
+/**
+ * @brief Close the websocket and the socket underneath it, after the connection was lost or
+ * before the connection thread exits. A frame that was partly sent is sent again from the start
+ * on the next connection, a message that was partly received is dropped.
+ */
+static void closeWebsocket(WebSocket *ws_inst)
+{
+	disconnectWebsocket(ws_inst);
+
+	PacketBufferPool::unref(ws_inst->_ws_rx_buf);
+	ws_inst->_ws_rx_buf = NULL;
+	abortRxMessage(ws_inst);
+	ws_inst->_ws_tx_pos = 0;
+}
+
+/**
+ * @brief Turn a packet into a masked websocket frame, as required for frames sent by a client.
+ * The frame header is written in the headroom of the buffer and the payload is masked in place,
+ * so the payload is never copied.
+ *
+ * @param buf Packet buffer, holds the frame afterwards.
+ * @param opcode Opcode of the frame.
+ *
+ * @return CS_OK if the frame was built, CS_ERR_PACKET_BUFFER_NO_SPACE if the header didn't fit.
+ */
+static cs_ret_code_t buildFrame(cs_packet_buf *buf, uint8_t opcode)
+{
+	uint16_t len = buf->len;
+	uint8_t *payload = buf->data;
+	bool len_16 = len >= CS_WEBSOCKET_FRAME_LEN_16;
+
+	uint8_t *hdr = PacketBufferPool::push(buf, 2 + (len_16 ? 2 : 0) + CS_WEBSOCKET_MASK_SIZE);
+	if (hdr == NULL) {
+		return CS_ERR_PACKET_BUFFER_NO_SPACE;
+	}
+
+	*hdr++ = CS_WEBSOCKET_FRAME_FIN | opcode;
+	if (len_16) {
+		*hdr++ = CS_WEBSOCKET_FRAME_MASK | CS_WEBSOCKET_FRAME_LEN_16;
+		sys_put_be16(len, hdr);
+		hdr += 2;
+	} else {
+		*hdr++ = CS_WEBSOCKET_FRAME_MASK | len;
+	}
+
+	// the masking key directly precedes the payload
+	sys_put_be32(sys_rand32_get(), hdr);
+	for (uint16_t i = 0; i < len; i++) {
+		payload[i] ^= hdr[i % CS_WEBSOCKET_MASK_SIZE];
+	}
+
+	return CS_OK;
+}
+
+/**
+ * @brief Take the next packet to send, results before data, and build its frame. The frame has
+ * to be sent completely within @ref CS_WEBSOCKET_TX_FRAME_TIMEOUT_MS.
+ *
+ * @return True if a frame is ready to be sent.
+ */
+static bool loadTxFrame(WebSocket *ws_inst)
+{
+	cs_packet_buf *buf;
+
+	while (true) {
+		buf = ws_inst->_ws_tx_result_queue.get();
+		if (buf == NULL) {
+			buf = ws_inst->_ws_tx_data_queue.get();
+		}
+		if (buf == NULL) {
+			return false;
+		}
+		if (buildFrame(buf, CS_WEBSOCKET_TX_OPCODE) == CS_OK) {
+			break;
+		}
+		LOG_WRN("%s", "No headroom for websocket frame header, packet dropped");
+		PacketBufferPool::unref(buf);
+	}
+
+	ws_inst->_ws_tx_buf = buf;
+	ws_inst->_ws_tx_pos = 0;
+	ws_inst->_ws_tx_deadline = k_uptime_get() + CS_WEBSOCKET_TX_FRAME_TIMEOUT_MS;
+
+	return true;
+}
+
+/**
+ * @brief Send queued frames, as far as the socket accepts them without blocking. The websocket
+ * library writes its own control frames to the same socket, e.g. a pong while receiving or a
+ * close frame on disconnect. It is only called while no frame is partly sent, so those are never
+ * written into the middle of a frame.
+ *
+ * @param ws_inst Pointer to the class instance.
+ *
+ * @return 0 if all queued frames were sent, -EAGAIN if the socket can't take more data, or a
+ * negative errno if sending failed.
+ */
+static int sendFrames(WebSocket *ws_inst)
+{
+	while (ws_inst->_ws_tx_buf != NULL || loadTxFrame(ws_inst)) {
+		cs_packet_buf *buf = ws_inst->_ws_tx_buf;
+
+		// frames are written to the socket underneath the websocket, which doesn't keep
+		// track of sent frames
+		ssize_t ret = zsock_send(ws_inst->_sock_id, buf->data + ws_inst->_ws_tx_pos,
+					 buf->len - ws_inst->_ws_tx_pos, ZSOCK_MSG_DONTWAIT);
+		if (ret < 0) {
+			return -errno;
+		}
+
+		ws_inst->_ws_tx_pos += ret;
+		if (ws_inst->_ws_tx_pos == buf->len) {
+			LOG_DBG("Sent %d bytes", buf->len);
+			PacketBufferPool::unref(buf);
+			ws_inst->_ws_tx_buf = NULL;
+			ws_inst->_ws_tx_pos = 0;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Pass on the received part of a message that doesn't fit in one packet buffer. It is
+ * delivered to the stream consumer as a fragment, or dropped if there is none.
+ *
+ * @param ws_inst Pointer to the class instance.
+ * @param last Set if the message is complete with this fragment.
+ */
+static void passRxFragment(WebSocket *ws_inst, bool last)
+{
+	cs_packet_buf *buf = ws_inst->_ws_rx_buf;
+
+	if (ws_inst->_rx_cb == NULL && !ws_inst->_ws_rx_discard) {
+		LOG_WRN("%s", "Websocket message doesn't fit in a packet buffer, dropping");
+		ws_inst->_ws_rx_discard = true;
+	}
+
+	if (ws_inst->_ws_rx_discard) {
+		// the buffer is reused to drain the rest of the message
+		ws_inst->_ws_rx_offset += ws_inst->_ws_rx_len;
+		ws_inst->_ws_rx_len = 0;
+	} else {
+		buf->len = ws_inst->_ws_rx_len;
+		buf->type = CS_DATA_INCOMING;
+		buf->src_id = ws_inst->_src_id;
+		ws_inst->_ws_rx_buf = NULL;
+
+		// the reference is moved to the consumer
+		uint32_t offset = ws_inst->_ws_rx_offset;
+		ws_inst->_ws_rx_offset += buf->len;
+		ws_inst->_rx_cb(buf, offset, last, ws_inst->_rx_cb_ctx);
+	}
+
+	if (last) {
+		ws_inst->_ws_rx_offset = 0;
+		ws_inst->_ws_rx_discard = false;
+	}
+}
+
+/**
+ * @brief Receive the available part of a message without blocking, and dispatch the message once
+ * it is complete. Messages that don't fit in one packet buffer are streamed in fragments, each
+ * time a buffer is full.
+ *
+ * @param ws_inst Pointer to the class instance.
+ *
+ * @return 0 if data was received, -EAGAIN if no data is available, -ENOBUFS if no packet buffer
+ * is available, -ECANCELED if the packet handler stopped, or a negative errno if the connection
+ * was closed.
+ */
+static int receiveMessage(WebSocket *ws_inst)
+{
+	uint32_t message_type;
+	uint64_t remaining_bytes;
+
+	// receive directly into a packet buffer, which is passed on without copying
+	if (ws_inst->_ws_rx_buf == NULL) {
+		ws_inst->_ws_rx_buf = ws_inst->_pkt_handler->allocBuffer(K_NO_WAIT);
+		if (ws_inst->_ws_rx_buf == NULL) {
+			return -ENOBUFS;
+		}
+		ws_inst->_ws_rx_len = 0;
+	}
+
+	cs_packet_buf *buf = ws_inst->_ws_rx_buf;
+	int ret = websocket_recv_msg(ws_inst->_websock_id, buf->data + ws_inst->_ws_rx_len,
+				     PacketBufferPool::tailroom(buf) - ws_inst->_ws_rx_len,
+				     &message_type, &remaining_bytes, 0);
+	if (ret < 0) {
+		return ret;
+	}
+
+	ws_inst->_ws_rx_len += ret;
+
+	// the size of a message sent in multiple frames is only known up to the current frame
+	uint64_t msg_len = ws_inst->_ws_rx_offset + ws_inst->_ws_rx_len + remaining_bytes;
+	if (msg_len > CS_WEBSOCKET_RX_MESSAGE_MAX_SIZE && !ws_inst->_ws_rx_discard) {
+		LOG_WRN("Websocket message exceeds %u bytes, dropping",
+			CS_WEBSOCKET_RX_MESSAGE_MAX_SIZE);
+		abortRxMessage(ws_inst);
+		ws_inst->_ws_rx_discard = true;
+	}
+
+	bool last = remaining_bytes == 0 && (message_type & WEBSOCKET_FLAG_FINAL);
+	bool full = PacketBufferPool::tailroom(buf) == ws_inst->_ws_rx_len;
+	if (!last && !full) {
+		return 0;
+	}
+
+	// a message that doesn't fit in one buffer, or that is already being streamed
+	if (!last || ws_inst->_ws_rx_offset > 0 || ws_inst->_ws_rx_discard) {
+		passRxFragment(ws_inst, last);
+		return 0;
+	}
+
+	LOG_DBG("Received %d bytes", ws_inst->_ws_rx_len);
+
+	buf->len = ws_inst->_ws_rx_len;
+	buf->type = CS_DATA_INCOMING;
+	buf->src_id = ws_inst->_src_id;
+	ws_inst->_ws_rx_buf = NULL;
+
+	// dispatch the buffer, the reference is moved to the handler
+	if (ws_inst->_pkt_handler->handlePacket(buf) == CS_ERR_ABORTED) {
+		return -ECANCELED;
+	}
 
 	return 0;
 }
 
 /**
- * @brief Handle receiving messages on the websocket.
- * Runs in a dedicated thread.
+ * @brief Serve the connection until it is lost or the thread is stopped. Receives messages and
+ * sends the queued frames without blocking on either, and sleeps in poll until the websocket is
+ * readable, can take more data, or the thread is woken up for a new packet to send. While a frame
+ * is partly sent, nothing is received until the frame is complete.
+ *
+ * @param ws_inst Pointer to the class instance.
+ */
+static void serveConnection(WebSocket *ws_inst)
+{
+	// a frame that was left from the previous connection gets a new deadline
+	ws_inst->_ws_tx_deadline = k_uptime_get() + CS_WEBSOCKET_TX_FRAME_TIMEOUT_MS;
+
+	while (!ws_inst->_ws_stop) {
+		int ret = sendFrames(ws_inst);
+		if (ret < 0 && ret != -EAGAIN) {
+			LOG_ERR("Could not send message over websocket (err %d)", ret);
+			return;
+		}
+
+		bool tx_blocked = ret == -EAGAIN;
+		int64_t tx_remaining_ms = ws_inst->_ws_tx_deadline - k_uptime_get();
+		if (tx_blocked && tx_remaining_ms <= 0) {
+			LOG_WRN("%s", "Websocket frame not sent before its deadline, link stalled");
+			return;
+		}
+
+		// receiving may make the websocket library reply with a control frame
+		bool rx_allowed = ws_inst->_ws_tx_pos == 0;
+		ret = rx_allowed ? receiveMessage(ws_inst) : -EAGAIN;
+		if (ret == 0) {
+			continue;
+		}
+		if (ret == -ECANCELED) {
+			// handler not running due to error, abort
+			ws_inst->_ws_stop = true;
+			return;
+		}
+		if (ret != -EAGAIN && ret != -ENOBUFS) {
+			LOG_DBG("Websocket connection closed while waiting (%d/%d)", ret, errno);
+			return;
+		}
+
+		// nothing more can be sent or received, sleep till that changes. Data buffered by
+		// the websocket is always received first, as poll won't report it.
+		short events = tx_blocked ? ZSOCK_POLLOUT : 0;
+		int timeout_ms = tx_blocked ? (int)tx_remaining_ms : SYS_FOREVER_MS;
+		if (ret == -ENOBUFS) {
+			timeout_ms = tx_blocked ? MIN(timeout_ms, CS_WEBSOCKET_RX_ALLOC_RETRY_MS)
+						: CS_WEBSOCKET_RX_ALLOC_RETRY_MS;
+		} else if (rx_allowed) {
+			events |= ZSOCK_POLLIN;
+		}
+
+		ret = waitWebsocket(ws_inst, events, timeout_ms);
+		if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+			LOG_ERR("Failed to poll websocket (err %d)", ret);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Supervise the websocket connection. Runs in a dedicated thread, which connects, receives
+ * messages until the connection is lost, and then reconnects after a backoff. The backoff doubles
+ * after each failed attempt, and is randomized so routers that lost the link at the same time
+ * don't reconnect in lockstep.
  *
  * @param inst Pointer to the class instance.
  * @param unused1 Unused parameter, is NULL.
  * @param unused2 Unused parameter, is NULL.
  */
-static void handleMessageReceived(void *inst, void *unused1, void *unused2)
+static void handleConnection(void *inst, void *unused1, void *unused2)
 {
 	WebSocket *ws_inst = static_cast<WebSocket *>(inst);
+	uint32_t backoff_ms = CS_WEBSOCKET_BACKOFF_MIN_MS;
+
+	while (!ws_inst->_ws_stop) {
+		// data queued while the link was down is sent once connected
+		if (ws_inst->open() == CS_OK) {
+			backoff_ms = CS_WEBSOCKET_BACKOFF_MIN_MS;
+			serveConnection(ws_inst);
+			closeWebsocket(ws_inst);
+		}
 
-	uint32_t message_type;
-	uint64_t remaining_bytes = ULLONG_MAX;
-
-	// wait for connection to websocket before trying to receive messages from
-	// peripherals
-	k_event_wait(&ws_inst->_ws_evts, CS_WEBSOCKET_CONNECTED_EVENT, false, K_FOREVER);
-
-	while (1) {
-		int ret, read_pos = 0, total_read = 0;
-		// receive data if available, don't block until it is
-		while (remaining_bytes > 0) {
-			ret = websocket_recv_msg(ws_inst->_websock_id,
-						 (ws_inst->_ws_recv_buf + read_pos),
-						 (sizeof(ws_inst->_ws_recv_buf) - read_pos),
-						 &message_type, &remaining_bytes, 0);
-			// there is still data available, try receiving the rest
-			// or: there is no data available, wait for 50ms and reschedule
-			if (ret < 0) {
-				if (ret == -EAGAIN) {
-					k_msleep(CS_WEBSOCKET_RECV_RETRY_TIMOUT);
-					continue;
-				}
-				LOG_DBG("Websocket connection closed while waiting (%d/%d)", ret,
-					errno);
-				break;
-			}
-			read_pos += ret;
-			total_read += ret;
-		}
-
-		LOG_DBG("Received %d bytes", total_read);
-
-		// this struct is copied into the work handler
-		cs_packet_data ws_data;
-		memset(&ws_data, 0, sizeof(ws_data));
-		ws_data.msg.buf_len = total_read;
-		ws_data.type = CS_DATA_INCOMING;
-		ws_data.src_id = ws_inst->_src_id;
-		memcpy(&ws_data.msg.buf, ws_inst->_ws_recv_buf, total_read);
-
-		if (ws_inst->_pkt_handler != NULL) {
-			// dispatch the work item
-			int ret = ws_inst->_pkt_handler->handlePacket(&ws_data);
-			// handler not running due to error, abort
-			if (ret == CS_ERR_ABORTED) {
-				break;
-			}
-		} else {
-			LOG_WRN("%s", "Failed to handle websocket packet");
+		if (ws_inst->_ws_stop) {
 			break;
 		}
 
-		remaining_bytes = ULLONG_MAX;
+		// wait between half and the full backoff, waking up only to stop
+		uint32_t delay_ms = backoff_ms / 2 + sys_rand32_get() % (backoff_ms / 2 + 1);
+		LOG_INF("Websocket disconnected, reconnecting in %u ms", delay_ms);
+
+		int64_t deadline = k_uptime_get() + delay_ms;
+		int64_t remaining_ms;
+		while (!ws_inst->_ws_stop && (remaining_ms = deadline - k_uptime_get()) > 0) {
+			waitWebsocket(ws_inst, 0, (int)remaining_ms);
+		}
+
+		backoff_ms = MIN(backoff_ms * 2, CS_WEBSOCKET_BACKOFF_MAX_MS);
 	}
+
+	closeWebsocket(ws_inst);
 }
 
 /**
- * @brief Open a websocket connection.
+ * @brief Open a websocket connection. The connection is made by the connection thread, which
+ * keeps reconnecting when the connection is lost until close() is called.
  *
  * @param url URL of the websocket, excluding the domain name or peer address and forward slash.
  * Max 30 characters, the rest is dropped. NULL if not required.
  *
- * @return CS_OK if connection is successful.
+ * @return CS_OK if the connection thread is started.
  */
 cs_ret_code_t WebSocket::connect(const char *url)
 {
@@ -117,26 +462,73 @@ cs_ret_code_t WebSocket::connect(const char *url)
 		return CS_ERR_NOT_INITIALIZED;
 	}
 
-	k_event_init(&_ws_evts);
+	if (_ws_conn_started) {
+		LOG_ERR("%s", "Already connected");
+		return CS_ERR_ALREADY_INITIALIZED;
+	}
+
+	if (_pkt_handler == NULL) {
+		return CS_ERR_INVALID_PARAM;
+	}
+
+	_ws_tx_result_queue.init(CS_WEBSOCKET_TX_RESULT_QUEUE_SIZE, CS_PACKET_QUEUE_DROP_NEWEST);
+	_ws_tx_data_queue.init(CS_WEBSOCKET_TX_DATA_QUEUE_SIZE, CS_WEBSOCKET_TX_DATA_POLICY);
+	_ws_tx_pos = 0;
+
+	// eventfd used to wake the connection thread out of poll, e.g. to stop it
+	if (_ws_wake_fd < 0) {
+		_ws_wake_fd = eventfd(0, EFD_NONBLOCK);
+		if (_ws_wake_fd < 0) {
+			LOG_ERR("Failed to create wakeup eventfd with errno: %d", -errno);
+			return CS_ERR_SOCKET_CREATION_FAILED;
+		}
+	}
+	_ws_stop = false;
+
+	// create url from forward slash + url if url provided, kept for reconnecting
+	char url_prefix[] = "/";
+	strcpy(_ws_url, url_prefix);
+	if (url != NULL) {
+		strncat(_ws_url, url, (sizeof(_ws_url) - sizeof(url_prefix)));
+	}
+
+	// connect and handle message receiving in a thread
+	k_thread_create(&_ws_tid, ws_tid_stack_area, K_THREAD_STACK_SIZEOF(ws_tid_stack_area),
+			handleConnection, this, NULL, NULL, CS_WEBSOCKET_THREAD_PRIORITY, 0,
+			K_NO_WAIT);
+	_ws_conn_started = true;
+
+	return CS_OK;
+}
+
+/**
+ * @brief Open the socket and perform the websocket handshake. A new socket is created if the
+ * previous connection was closed. Called by the connection thread.
+ *
+ * @return CS_OK if the websocket is connected.
+ */
+cs_ret_code_t WebSocket::open()
+{
+	cs_ret_code_t ret;
+
+	if (_sock_id < 0) {
+		ret = reinit();
+		if (ret != CS_OK) {
+			return ret;
+		}
+	}
 
 	if (zsock_connect(_sock_id, &_addr, _addr_len) < 0) {
 		LOG_ERR("Failed to connect to socket host with errno: %d", -errno);
+		Socket::close();
 		return CS_ERR_SOCKET_CONNECT_FAILED;
 	}
 
 	websocket_request ws_req;
 	memset(&ws_req, 0, sizeof(ws_req));
 
-	char url_buf[CS_WEBSOCKET_URL_MAX_LEN];
-	char url_prefix[] = "/";
-	strcpy(url_buf, url_prefix);
-	// create url from forward slash + url if url provided
-	if (url != NULL) {
-		strncat(url_buf, url, (sizeof(url_buf) - sizeof(url_prefix)));
-	}
-
 	ws_req.host = _host;
-	ws_req.url = url_buf;
+	ws_req.url = _ws_url;
 	ws_req.cb = handleWebsocketConnect;
 	ws_req.tmp_buf = _ws_recv_tmp_buf;
 	ws_req.tmp_buf_len = sizeof(_ws_recv_tmp_buf);
@@ -144,58 +536,80 @@ cs_ret_code_t WebSocket::connect(const char *url)
 	LOG_INF("Attempting connection to %s", _host);
 
 	// perform http handshake for websocket connection, and open connection
-	_websock_id = websocket_connect(_sock_id, &ws_req, SYS_FOREVER_MS, this);
+	_websock_id = websocket_connect(_sock_id, &ws_req, CS_WEBSOCKET_CONNECT_TIMEOUT_MS, this);
 	if (_websock_id < 0) {
-		LOG_ERR("Failed to connect to websocket on %s%s", _host, url_buf);
-		close();
+		LOG_ERR("Failed to connect to websocket on %s%s", _host, _ws_url);
+		_websock_id = -1;
+		Socket::close();
 		return CS_ERR_SOCKET_WEBSOCKET_CONNECT_FAILED;
 	}
 
-	// handle message receiving in a thread
-	k_tid_t ws_recv_thread =
-		k_thread_create(&_ws_tid, ws_tid_stack_area,
-				K_THREAD_STACK_SIZEOF(ws_tid_stack_area), handleMessageReceived,
-				this, NULL, NULL, CS_WEBSOCKET_THREAD_PRIORITY, 0, K_NO_WAIT);
-
 	return CS_OK;
 }
 
 /**
- * @brief Send message over websocket. Callback function for PacketHandler.
+ * @brief Queue messages to be sent over the websocket. Callback function for PacketHandler.
+ * The messages are sent by the connection thread, so this never blocks on the network. While the
+ * link is down, messages stay queued until the connection thread has reconnected.
  *
- * @param inst Pointer to WebSocket class instance.
- * @param message Pointer to buffer with the message.
- * @param len Length of the message.
+ * @param work Pointer to the work item of the packet handler.
  */
 void WebSocket::sendMessage(k_work *work)
 {
 	cs_packet_handler *hdlr = CONTAINER_OF(work, cs_packet_handler, work_item);
 	WebSocket *ws_inst = static_cast<WebSocket *>(hdlr->target_inst);
-	k_spinlock_key_t key;
-	int ret = 0;
+	cs_packet_buf *buf;
 
 	if (!ws_inst->_initialized) {
 		LOG_ERR("%s", "Not initialized");
 		return;
 	}
 
-	// wait for connection to websocket before trying to receive messages from peripherals
-	k_event_wait(&ws_inst->_ws_evts, CS_WEBSOCKET_CONNECTED_EVENT, false, K_FOREVER);
+	while ((buf = PacketHandler::takePacket(hdlr)) != NULL) {
+		PacketQueue *queue = buf->result ? &ws_inst->_ws_tx_result_queue
+						 : &ws_inst->_ws_tx_data_queue;
+		if (queue->put(buf) != CS_OK) {
+			LOG_WRN("%s", "Websocket transmit queue is full, packet dropped");
+		}
+	}
 
-	key = k_spin_lock(&hdlr->work_lock);
-	// a message is available, make sure it is sent over the websocket
-	ret = websocket_send_msg(ws_inst->_websock_id, hdlr->msg.buf, hdlr->msg.buf_len,
-				 WEBSOCKET_OPCODE_DATA_TEXT, true, true, SYS_FOREVER_MS);
-	k_spin_unlock(&hdlr->work_lock, key);
-	if (ret < 0) {
-		LOG_ERR("Could not send message over websocket (err %d)", ret);
+	ws_inst->wakeup();
+}
+
+/**
+ * @brief Wake the connection thread out of poll, e.g. to apply a new configuration or to stop it.
+ *
+ * @return CS_OK if the thread was woken up.
+ */
+cs_ret_code_t WebSocket::wakeup()
+{
+	if (_ws_wake_fd < 0) {
+		LOG_ERR("%s", "Not connected");
+		return CS_ERR_NOT_INITIALIZED;
 	}
 
-	LOG_DBG("Sent %d bytes", ret);
+	eventfd_write(_ws_wake_fd, 1);
+
+	return CS_OK;
 }
 
 /**
- * @brief Close websocket & BSD socket.
+ * @brief Stream messages that don't fit in one packet buffer to a consumer, e.g. firmware chunks
+ * or configuration blobs. Messages that fit are still routed through the packet handler. Without
+ * a consumer, such messages are dropped. Set before connecting.
+ *
+ * @param cb Callback that takes the fragments, NULL to drop large messages again
+ * @param ctx Context passed to the callback
+ */
+void WebSocket::setRxCallback(cs_websocket_rx_cb_t cb, void *ctx)
+{
+	_rx_cb_ctx = ctx;
+	_rx_cb = cb;
+}
+
+/**
+ * @brief Close websocket & BSD socket. The connection thread is stopped first, after which it
+ * no longer reconnects.
  */
 cs_ret_code_t WebSocket::close()
 {
@@ -204,10 +618,140 @@ cs_ret_code_t WebSocket::close()
 		return CS_ERR_NOT_INITIALIZED;
 	}
 
-	if (_websock_id >= 0) {
-		websocket_disconnect(_websock_id);
+	if (_ws_conn_started) {
+		_ws_stop = true;
+		wakeup();
+		if (k_thread_join(&_ws_tid, K_MSEC(CS_WEBSOCKET_STOP_TIMEOUT_MS)) != 0) {
+			LOG_WRN("%s", "Websocket connection thread did not stop, aborting it");
+			k_thread_abort(&_ws_tid);
+		}
+		_ws_conn_started = false;
 	}
-	Socket::close();
+
+	disconnectWebsocket(this);
+
+	// drop what wasn't sent, the queues are initialized again on the next connect
+	PacketBufferPool::unref(_ws_tx_buf);
+	_ws_tx_buf = NULL;
+	_ws_tx_result_queue.purge();
+	_ws_tx_data_queue.purge();
 
 	return CS_OK;
-}
\ No newline at end of file
+}
+
+#ifdef CS_WEBSOCKET_BENCHMARK
+/**
+ * @brief Send a frame and wait till the echo server has sent it back.
+ *
+ * @param ws_sock Websocket the frame is echoed on.
+ * @param sock Socket underneath the websocket, NULL to send with websocket_send_msg.
+ * @param buf Packet buffer with the payload, holds the frame afterwards if sock is given.
+ *
+ * @return 0 if the frame was echoed, a negative errno otherwise.
+ */
+static int echoBenchmarkFrame(int ws_sock, int sock, cs_packet_buf *buf)
+{
+	static uint8_t echo[CS_WEBSOCKET_BENCHMARK_SIZE];
+	uint32_t message_type;
+	uint64_t remaining_bytes;
+	int ret;
+
+	if (sock < 0) {
+		// copies and masks the payload in a temporary buffer
+		ret = websocket_send_msg(ws_sock, buf->data, buf->len, CS_WEBSOCKET_TX_OPCODE, true,
+					 true, SYS_FOREVER_MS);
+	} else {
+		ret = buildFrame(buf, CS_WEBSOCKET_TX_OPCODE) == CS_OK
+			      ? zsock_send(sock, buf->data, buf->len, 0)
+			      : -ENOBUFS;
+	}
+	if (ret < 0) {
+		return ret;
+	}
+
+	do {
+		ret = websocket_recv_msg(ws_sock, echo, sizeof(echo), &message_type,
+					 &remaining_bytes, SYS_FOREVER_MS);
+		if (ret < 0) {
+			return ret;
+		}
+	} while (remaining_bytes > 0);
+
+	return 0;
+}
+
+/**
+ * @brief Compare the frames per second of websocket_send_msg, which copies each payload to mask
+ * it, with frames built in the headroom of the packet buffer, and log the results. Each frame is
+ * echoed back by a websocket echo server before the next one is sent, so the server should run
+ * on the local network to keep the round trip from dominating.
+ *
+ * @param host IPv4 address of the echo server.
+ * @param port Port of the echo server.
+ */
+void cs_websocket_benchmark(const char *host, uint16_t port)
+{
+	static uint8_t tmp_buf[CS_PACKET_BUF_SIZE + CS_WEBSOCKET_HTTP_HEADER_SIZE];
+	uint32_t cycles[2] = {0};
+	Socket sock;
+
+	if (sock.init(host, CS_SOCKET_IPV4, port) != CS_OK) {
+		return;
+	}
+
+	sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	zsock_inet_pton(AF_INET, host, &addr.sin_addr);
+	if (zsock_connect(sock._sock_id, (sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOG_ERR("Failed to connect to benchmark server with errno: %d", -errno);
+		sock.close();
+		return;
+	}
+
+	websocket_request ws_req;
+	memset(&ws_req, 0, sizeof(ws_req));
+	ws_req.host = host;
+	ws_req.url = "/";
+	ws_req.tmp_buf = tmp_buf;
+	ws_req.tmp_buf_len = sizeof(tmp_buf);
+
+	int ws_sock = websocket_connect(sock._sock_id, &ws_req, CS_WEBSOCKET_CONNECT_TIMEOUT_MS,
+					NULL);
+	if (ws_sock < 0) {
+		LOG_ERR("Failed to connect to benchmark websocket (err %d)", ws_sock);
+		sock.close();
+		return;
+	}
+
+	// first websocket_send_msg, then frames built in the headroom
+	int ret = 0;
+	for (int mode = 0; mode < 2 && ret == 0; mode++) {
+		for (int i = 0; i < CS_WEBSOCKET_BENCHMARK_ITERATIONS && ret == 0; i++) {
+			cs_packet_buf *buf = PacketBufferPool::getInstance()->alloc(K_FOREVER);
+			memset(PacketBufferPool::add(buf, CS_WEBSOCKET_BENCHMARK_SIZE), i,
+			       CS_WEBSOCKET_BENCHMARK_SIZE);
+
+			uint32_t start = k_cycle_get_32();
+			ret = echoBenchmarkFrame(ws_sock, mode == 0 ? -1 : sock._sock_id, buf);
+			cycles[mode] += k_cycle_get_32() - start;
+			PacketBufferPool::unref(buf);
+		}
+	}
+
+	// also closes the socket underneath it
+	websocket_disconnect(ws_sock);
+
+	if (ret < 0) {
+		LOG_ERR("Websocket benchmark failed (err %d)", ret);
+		return;
+	}
+
+	uint64_t frames_cyc = (uint64_t)CS_WEBSOCKET_BENCHMARK_ITERATIONS *
+			      sys_clock_hw_cycles_per_sec();
+	LOG_INF("Websocket echo of %u frames of %u bytes: send_msg %u frames/s, headroom %u "
+		"frames/s",
+		CS_WEBSOCKET_BENCHMARK_ITERATIONS, CS_WEBSOCKET_BENCHMARK_SIZE,
+		(uint32_t)(frames_cyc / cycles[0]), (uint32_t)(frames_cyc / cycles[1]));
+}
+#endif
\ No newline at end of file